@@ -0,0 +1,837 @@
+#define XNN_IMPLEMENTATION
+#include "xnn.h"
+#include <stdio.h>
+#include <time.h>
+
+/* Throughput numbers for the kernels behind the demos.
+ * Build: make build/demos/bench   Run: ./build/demos/bench */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The original i-j-k matrix_dot, kept as the baseline */
+static void dot_naive(Matrix *dst, const Matrix *a, const Matrix *b)
+{
+    matrix_fill(dst, 0);
+    for (size_t i = 0; i < a->rows; i++)
+        for (size_t j = 0; j < b->cols; j++)
+            for (size_t k = 0; k < a->cols; k++)
+                dst->data[i*dst->cols+j] += a->data[i*a->cols+k] * b->data[k*b->cols+j];
+}
+
+/* The per-sample backprop that batched backprop replaced, kept as the baseline */
+static void backprop_sample(Network *net, Network *grad, const Data *data)
+{
+    size_t batch = data->in->rows, in_sz = data->in->cols, out_sz = data->out->cols;
+    size_t L = net->layers-1;
+    network_zero(grad);
+    for (size_t s = 0; s < batch; s++) {
+        for (size_t l = 1; l < net->layers; l++) matrix_fill(grad->a[l], 0);
+        memcpy(net->a[0]->data, &data->in->data[s*in_sz], in_sz*sizeof(float));
+        forward(net);
+        for (size_t j = 0; j < out_sz; j++) {
+            float p = net->a[L]->data[j], t = data->out->data[s*out_sz+j];
+            grad->a[L]->data[j] = net->loss == LOSS_MSE ? 2*(p-t) : p-t;
+        }
+        for (size_t l = L; l > 0; --l)
+            for (size_t j = 0; j < net->a[l]->rows; j++) {
+                float a = net->a[l]->data[j], da = grad->a[l]->data[j];
+                int act = net->activations[l];
+                float ds = (l == L && net->loss == LOSS_CE && act == ACT_SOFTMAX) ? 1.0f :
+                           act == ACT_SIGMOID ? dact_sigmoid(a) : act == ACT_TANH ? dact_tanh(a) :
+                           act == ACT_RELU ? dact_relu(a) : act == ACT_LINEAR ? 1.0f : 0.0f;
+                grad->b[l-1]->data[j] += da * ds;
+                for (size_t k = 0; k < net->a[l-1]->rows; k++) {
+                    size_t wi = j*net->w[l-1]->cols + k;
+                    grad->w[l-1]->data[wi] += da * ds * net->a[l-1]->data[k];
+                    if (l > 1) grad->a[l-1]->data[k] += da * ds * net->w[l-1]->data[wi];
+                }
+            }
+    }
+    for (size_t i = 0; i < grad->layers-1; i++) {
+        for (size_t j = 0; j < grad->w[i]->rows*grad->w[i]->cols; j++) grad->w[i]->data[j] /= batch;
+        for (size_t j = 0; j < grad->b[i]->rows; j++) grad->b[i]->data[j] /= batch;
+    }
+}
+
+static void bench_gemm(void)
+{
+    /* {M, N, K, label}: C(MxN) = A(MxK) * B(KxN) */
+    static const struct { size_t m, n, k; const char *what; } shapes[] = {
+        {128,   1, 784, "mnist L1 forward (GEMV)"},
+        { 10,   1, 128, "mnist L2 forward (GEMV)"},
+        { 64, 128, 784, "mnist L1 batch 64"},
+        { 64,  10, 128, "mnist L2 batch 64"},
+        {128, 784,  64, "mnist L1 dW, batch 64"},
+        {256,   1, 256, "char_rnn Whh*h"},
+        { 32,  28,  42, "image_fourier L1 batch 32"},
+        {512, 512, 512, "square 512"},
+    };
+    int best = xnn_set_isa(-1);
+    printf("%-28s %14s %10s", "GEMM GFLOPS", "MxNxK", "naive");
+    for (int isa = ISA_SCALAR; isa <= best; ++isa) printf(" %10s", xnn_isa_name(isa));
+    printf("\n");
+    for (size_t s = 0; s < ARRAY_LEN(shapes); ++s) {
+        size_t M = shapes[s].m, N = shapes[s].n, K = shapes[s].k;
+        Matrix *a = matrix_alloc(M, K), *b = matrix_alloc(K, N), *c = matrix_alloc(M, N);
+        matrix_rand(a, -1, 1); matrix_rand(b, -1, 1);
+        char dims[32];
+        snprintf(dims, sizeof(dims), "%zux%zux%zu", M, N, K);
+        printf("%-28s %14s", shapes[s].what, dims);
+        for (int v = -1; v <= best; ++v) {
+            size_t iters = 0;
+            double t0 = now(), t;
+            if (v >= 0) xnn_set_isa(v);
+            do {
+                if (v >= 0) matrix_dot(c, a, b); else dot_naive(c, a, b);
+                ++iters;
+            } while ((t = now() - t0) < 0.2);
+            printf(" %10.2f", 2.0 * M * N * K * iters / t * 1e-9);
+        }
+        printf("\n");
+        matrix_free(a); matrix_free(b); matrix_free(c);
+    }
+    xnn_set_isa(best);
+}
+
+static void bench_elementwise(void)
+{
+    /* apply_grad-sized streams: MNIST 784x128 weights */
+    const size_t n = 784*128;
+    Matrix *x = matrix_alloc(1, n), *y = matrix_alloc(1, n);
+    matrix_rand(x, -1, 1); matrix_rand(y, -1, 1);
+    int best = xnn_set_isa(-1);
+    printf("\n%-28s", "elementwise GB/s");
+    for (int isa = ISA_SCALAR; isa <= best; ++isa) printf(" %10s", xnn_isa_name(isa));
+    printf("\n");
+    for (int op = 0; op < 3; ++op) {
+        static const char *ops[] = {"matrix_sum", "matrix_norm", "act_relu"};
+        printf("%-28s", ops[op]);
+        for (int isa = ISA_SCALAR; isa <= best; ++isa) {
+            xnn_set_isa(isa);
+            size_t iters = 0;
+            double t0 = now(), t;
+            do {
+                if (op == 0) matrix_sum(y, x);
+                else if (op == 1) matrix_norm(x);
+                else act_relu(y);
+                ++iters;
+            } while ((t = now() - t0) < 0.1);
+            printf(" %10.2f", (op == 0 ? 12.0 : op == 1 ? 4.0 : 8.0) * n * iters / t * 1e-9);
+        }
+        printf("\n");
+    }
+    xnn_set_isa(best);
+    matrix_free(x); matrix_free(y);
+}
+
+static void bench_activations(void)
+{
+    /* libm vs. polynomial, and a render_prediction-style inference loop */
+    const size_t n = 1 << 16;
+    Matrix *x = matrix_alloc(1, n), *src = matrix_alloc(1, n);
+    matrix_rand(src, -4, 4);
+    printf("\n%-28s %10s %10s\n", "activation Melem/s", "exact", "fast");
+    for (int act = ACT_SIGMOID; act <= ACT_TANH; ++act) {
+        printf("%-28s", act == ACT_SIGMOID ? "sigmoid" : "tanh");
+        for (int fast = 0; fast < 2; ++fast) {
+            size_t iters = 0;
+            double t0 = now(), t;
+            do {
+                matrix_copy(x, src);
+                activate(x, act, fast);
+                ++iters;
+            } while ((t = now() - t0) < 0.1);
+            printf(" %10.1f", n * iters / t * 1e-6);
+        }
+        printf("\n");
+    }
+    matrix_free(x); matrix_free(src);
+
+    size_t arch[] = {42, 28, 28, 28, 1};
+    int    act[]  = {ACT_RELU, ACT_TANH, ACT_TANH, ACT_TANH, ACT_TANH};
+    Network *net = network_alloc(arch, ARRAY_LEN(arch), act, LOSS_MSE);
+    printf("%-28s", "42-28x3-1 tanh forward/s");
+    for (int fast = 0; fast < 2; ++fast) {
+        network_set_fast_math(net, fast);
+        size_t iters = 0;
+        double t0 = now(), t;
+        do { forward(net); ++iters; } while ((t = now() - t0) < 0.2);
+        printf(" %9.2fM", iters / t * 1e-6);
+    }
+    printf("\n");
+    network_free(net);
+}
+
+static void bench_forward(void)
+{
+    /* MNIST 784-128-10 inference: column-vector forward vs. batch GEMMs */
+    size_t arch[] = {784, 128, 10};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+    Network *net = network_alloc(arch, 3, act, LOSS_CE);
+    Matrix *x = matrix_alloc(64, 784);
+    matrix_rand(x, 0, 1);
+    printf("\n%-28s %10s %10s\n", "mnist forward samples/s", "per-sample", "batch 64");
+    double rate[2];
+    for (int v = 0; v < 2; ++v) {
+        size_t iters = 0;
+        double t0 = now(), t;
+        do {
+            if (v) forward_batch(net, x);
+            else for (size_t s = 0; s < 64; ++s) {
+                memcpy(net->a[0]->data, &x->data[s*784], 784*sizeof(float));
+                forward(net);
+            }
+            ++iters;
+        } while ((t = now() - t0) < 0.3);
+        rate[v] = 64.0 * iters / t;
+    }
+    printf("%-28s %10.0f %10.0f\n", "", rate[0], rate[1]);
+    network_free(net); matrix_free(x);
+}
+
+static void bench_backprop(void)
+{
+    /* MNIST 784-128-10, batch 64: per-sample vs. batched backward pass */
+    size_t arch[] = {784, 128, 10};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+    Network *net  = network_alloc(arch, 3, act, LOSS_CE);
+    Network *g[2] = {network_alloc(arch, 3, act, LOSS_CE), network_alloc(arch, 3, act, LOSS_CE)};
+    Matrix *x = matrix_alloc(64, 784), *y = matrix_alloc(64, 10);
+    matrix_rand(x, 0, 1);
+    matrix_fill(y, 0);
+    for (size_t s = 0; s < 64; ++s) y->data[s*10 + rand()%10] = 1.0f;
+    Data data = {x, y, NULL};
+
+    printf("\n%-28s %10s %10s\n", "mnist backprop samples/s", "per-sample", "batched");
+    double rate[2];
+    for (int v = 0; v < 2; ++v) {
+        size_t iters = 0;
+        double t0 = now(), t;
+        do {
+            if (v) backprop(net, g[1], &data); else backprop_sample(net, g[0], &data);
+            ++iters;
+        } while ((t = now() - t0) < 0.5);
+        rate[v] = 64.0 * iters / t;
+    }
+    float diff = 0.0f;
+    for (size_t l = 0; l < 2; ++l)
+        for (size_t i = 0; i < g[0]->w[l]->rows*g[0]->w[l]->cols; ++i)
+            diff = fmaxf(diff, fabsf(g[0]->w[l]->data[i] - g[1]->w[l]->data[i]));
+    printf("%-28s %10.0f %10.0f  (%.1fx, max |dW diff| %.1e)\n", "", rate[0], rate[1], rate[1]/rate[0], diff);
+    network_free(net); network_free(g[0]); network_free(g[1]);
+    matrix_free(x); matrix_free(y);
+}
+
+static void bench_views(void)
+{
+    /* mnist.c's epoch: 64-row batches drawn from a shuffled 60000x785
+     * label+pixel matrix, copied out per batch vs. read through views */
+    size_t arch[] = {784, 128, 10};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+    Network *net = network_alloc(arch, 3, act, LOSS_CE), *grad = network_alloc(arch, 3, act, LOSS_CE);
+    Matrix *raw = matrix_alloc(60000, 785), *y = matrix_alloc(60000, 10);
+    Matrix *bx = matrix_alloc(64, 784), *by = matrix_alloc(64, 10);
+    matrix_rand(raw, 0, 1);
+    matrix_fill(y, 0);
+    size_t *idx = malloc(60000*sizeof(size_t));
+    for (size_t i = 0; i < 60000; ++i) { idx[i] = i; y->data[i*10 + rand()%10] = 1.0f; }
+    for (size_t i = 59999; i > 0; --i) { size_t j = rand() % (i+1), t = idx[i]; idx[i] = idx[j]; idx[j] = t; }
+    Tensor X = tensor_slice(matrix_view(raw), 1, 1, 785), Y = matrix_view(y);
+    Data data = {bx, by, NULL};
+    printf("\n%-28s %10s %10s\n", "mnist batches/s", "memcpy", "gather");
+    printf("%-28s", "shuffled, batch 64");
+    for (int v = 0; v < 2; ++v) {
+        size_t iters = 0;
+        double t0 = now(), t;
+        do {
+            const size_t *b = idx + (iters % 937)*64;
+            if (v) {
+                Tensor bi = tensor_gather(X, b, 64), bo = tensor_gather(Y, b, 64);
+                backprop_view(net, grad, &bi, &bo);
+            } else {
+                for (size_t i = 0; i < 64; ++i) {
+                    memcpy(&bx->data[i*784], tensor_row(&X, b[i]), 784*sizeof(float));
+                    memcpy(&by->data[i*10], &y->data[b[i]*10], 10*sizeof(float));
+                }
+                backprop(net, grad, &data);
+            }
+            ++iters;
+        } while ((t = now() - t0) < 0.5);
+        printf(" %10.0f", iters / t);
+    }
+    printf("\n");
+    network_free(net); network_free(grad);
+    matrix_free(raw); matrix_free(y); matrix_free(bx); matrix_free(by); free(idx);
+}
+
+static void bench_predict_batch(void)
+{
+    /* image_fourier.c's upscaled render: 1024x1024 pixels through
+     * 42-28-28-28-1, one network_predict per pixel vs. network_predict_batch */
+    size_t arch[] = {42, 28, 28, 28, 1};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_RELU, ACT_RELU, ACT_TANH};
+    Network *net = network_alloc(arch, 5, act, LOSS_MSE);
+    size_t n = 1024*1024;
+    Matrix *x = matrix_alloc(n, 42);
+    matrix_rand(x, -1, 1);
+    float *o = malloc(n*sizeof(float));
+    double t[2];
+    for (int v = 0; v < 2; ++v) {
+        double t0 = now();
+        if (v) network_predict_batch(net, x->data, n, o);
+        else for (size_t i = 0; i < n; ++i) network_predict(net, &x->data[i*42], &o[i]);
+        t[v] = now() - t0;
+    }
+    printf("\n%-28s %10s %10s\n", "1024x1024 render ms", "per-pixel", "batch");
+    printf("%-28s %10.1f %10.1f  (%.1fx)\n", "", t[0]*1e3, t[1]*1e3, t[0]/t[1]);
+    network_free(net); matrix_free(x); free(o);
+}
+
+/* Adam as separate whole-array passes, kept as the baseline */
+static void adam_passes(float *w, float *m, float *v, const float *g, size_t n, float lr, int t)
+{
+    const float b1 = 0.9f, b2 = 0.999f, c1 = 1.0f / (1.0f - powf(b1, t)), c2 = 1.0f / (1.0f - powf(b2, t));
+    for (size_t i = 0; i < n; ++i) m[i] = b1*m[i] + (1-b1)*g[i];
+    for (size_t i = 0; i < n; ++i) v[i] = b2*v[i] + (1-b2)*g[i]*g[i];
+    for (size_t i = 0; i < n; ++i) w[i] -= lr * (m[i]*c1) / (sqrtf(v[i]*c2) + 1e-8f);
+}
+
+static void bench_optimizer(void)
+{
+    /* one update over 4M parameters (past the caches): GB/s counts the
+     * w, g, m, v traffic each method needs at minimum */
+    const size_t n = 4u << 20;
+    float *w = xnn_alloc(n*sizeof(float)), *g = xnn_alloc(n*sizeof(float));
+    float *m = xnn_alloc(n*sizeof(float)), *v = xnn_alloc(n*sizeof(float));
+    for (size_t i = 0; i < n; ++i) { w[i] = rand_float(-1, 1); g[i] = rand_float(-1, 1); m[i] = v[i] = 0; }
+    printf("\n%-28s %10s %10s\n", "optimizer step, 4M params", "steps/s", "GB/s");
+    for (int k = 0; k < 6; ++k) {
+        static const char *names[] = {"Adam, three passes", "SGD fused", "Momentum fused",
+                                      "RMSProp fused", "Adam fused", "AdamW fused"};
+        static const double bytes[] = {40, 12, 20, 20, 28, 28};   /* per parameter */
+        Optimizer *o = k ? optimizer_alloc(n, k-1, 1e-3f) : NULL;
+        size_t iters = 0;
+        double t0 = now(), t;
+        do {
+            if (k) optimizer_update(o, w, g);
+            else adam_passes(w, m, v, g, n, 1e-3f, (int)iters + 1);
+            ++iters;
+        } while ((t = now() - t0) < 0.3);
+        printf("%-28s %10.1f %10.2f\n", names[k], iters / t, bytes[k] * n * iters / t * 1e-9);
+        optimizer_free(o);
+    }
+    xnn_free(w); xnn_free(g); xnn_free(m); xnn_free(v);
+
+    /* clipped SGD training step: norm + scale passes (mnist.c's old
+     * clip_grad) vs. the norm taken in backprop and the scale in the step */
+    {
+        size_t arch[] = {784, 1024, 1024, 10};
+        int    act[]  = {ACT_RELU, ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+        Network *net = network_alloc(arch, 4, act, LOSS_CE), *grad = network_alloc(arch, 4, act, LOSS_CE);
+        Matrix *in = matrix_alloc(64, 784), *out = matrix_alloc(64, 10);
+        matrix_rand(in, 0, 1); matrix_fill(out, 0.1f);
+        Data data = {in, out, NULL};
+        size_t np = 0;
+        float *gp = network_params(grad, &np);
+        Optimizer *o = optimizer_alloc(np, OPT_SGD, 1e-3f);
+        optimizer_set_clip(o, 1e-3f, 0.0f);
+        printf("%-28s %10s\n", "clipped step, 1.9M params", "steps/s");
+        for (int k = 0; k < 2; ++k) {
+            size_t iters = 0;
+            double t0 = now(), t;
+            do {
+                backprop(net, grad, &data);
+                if (k) optimizer_step(o, net, grad);
+                else {
+                    float norm = network_norm(grad);
+                    if (norm > 1e-3f) xk()->scale(gp, 1e-3f / norm, np);
+                    apply_grad(net, grad, 1e-3f);
+                }
+                ++iters;
+            } while ((t = now() - t0) < 0.5);
+            printf("%-28s %10.1f\n", k ? "fused clip in optimizer" : "norm + scale + apply_grad", iters / t);
+        }
+        optimizer_free(o); network_free(net); network_free(grad);
+        matrix_free(in); matrix_free(out);
+    }
+
+    /* steps for a 32-64-4 student to fit a random teacher (batch 64,
+     * MSE on 256 held-out rows); SGD plateaus around 5e-3 */
+    size_t arch[] = {32, 64, 4};
+    int    act[]  = {ACT_TANH, ACT_TANH, ACT_LINEAR};
+    Network *teacher = network_alloc(arch, 3, act, LOSS_MSE);
+    Matrix *in = matrix_alloc(64, 32), *out = matrix_alloc(64, 4);
+    Matrix *tin = matrix_alloc(256, 32), *tout = matrix_alloc(256, 4);
+    matrix_rand(tin, -1, 1);
+    matrix_copy(tout, forward_batch(teacher, tin));
+    Data data = {in, out, NULL}, test = {tin, tout, NULL};
+    printf("%-28s %10s %10s\n", "steps to MSE < 3e-3", "steps", "seconds");
+    for (int k = 0; k < 2; ++k) {
+        Network *net = network_alloc(arch, 3, act, LOSS_MSE), *grad = network_alloc(arch, 3, act, LOSS_MSE);
+        size_t np = 0;
+        network_params(net, &np);
+        Optimizer *o = k ? optimizer_alloc(np, OPT_ADAM, 3e-3f) : NULL;
+        int step = 0;
+        double t0 = now();
+        while (step < 10000 && (step % 100 || network_mse(net, &test) >= 3e-3f)) {
+            matrix_rand(in, -1, 1);
+            matrix_copy(out, forward_batch(teacher, in));
+            backprop(net, grad, &data);
+            if (k) optimizer_step(o, net, grad);
+            else apply_grad(net, grad, 0.3f);
+            ++step;
+        }
+        char steps[16] = ">10000";
+        if (step < 10000) snprintf(steps, sizeof steps, "%d", step);
+        printf("%-28s %10s %10.2f\n", k ? "Adam, lr 3e-3" : "SGD, lr 0.3", steps, now() - t0);
+        optimizer_free(o); network_free(net); network_free(grad);
+    }
+    matrix_free(tin); matrix_free(tout);
+    network_free(teacher); matrix_free(in); matrix_free(out);
+}
+
+static void bench_loss(void)
+{
+    /* a loss number per MNIST-shaped step: an extra evaluation pass vs.
+     * the one backprop returns */
+    size_t arch[] = {784, 128, 10};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+    Network *net = network_alloc(arch, 3, act, LOSS_CE), *grad = network_alloc(arch, 3, act, LOSS_CE);
+    Matrix *in = matrix_alloc(64, 784);
+    uint16_t labels[64];
+    matrix_rand(in, 0, 1);
+    for (int i = 0; i < 64; ++i) labels[i] = (uint16_t)(i % 10);
+    Tensor x = matrix_view(in);
+    printf("\n%-28s %10s\n", "CE step + loss, batch 64", "steps/s");
+    for (int k = 0; k < 2; ++k) {
+        size_t iters = 0;
+        float loss = 0.0f;
+        double t0 = now(), t;
+        do {
+            loss = backprop_labels(net, grad, &x, labels);
+            if (!k) loss = network_loss_labels(net, &x, labels);
+            ++iters;
+        } while ((t = now() - t0) < 0.3);
+        printf("%-28s %10.0f  (loss %.4f)\n", k ? "loss from backprop" : "backprop + network_loss", iters / t, loss);
+    }
+    network_free(net); network_free(grad); matrix_free(in);
+}
+
+static void bench_threads(void)
+{
+    /* MNIST 784-128-10 backprop scaling; shards are >= 8 rows, so batch 64
+     * tops out at 8 threads */
+    static const int threads[] = {1, 2, 4, 8, 16};
+    size_t arch[] = {784, 128, 10};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+    Network *net  = network_alloc(arch, 3, act, LOSS_CE);
+    Network *grad = network_alloc(arch, 3, act, LOSS_CE);
+    int saved = xnn_get_threads();
+    printf("\n%-28s", "backprop samples/s");
+    for (size_t t = 0; t < ARRAY_LEN(threads); ++t) printf(" %7d thr", threads[t]);
+    printf("\n");
+    for (size_t batch = 64; batch <= 256; batch *= 4) {
+        Matrix *x = matrix_alloc(batch, 784), *y = matrix_alloc(batch, 10);
+        matrix_rand(x, 0, 1);
+        matrix_fill(y, 0);
+        for (size_t s = 0; s < batch; ++s) y->data[s*10 + rand()%10] = 1.0f;
+        Data data = {x, y, NULL};
+        char label[32];
+        snprintf(label, sizeof(label), "batch %zu", batch);
+        printf("%-28s", label);
+        double base = 0.0;
+        for (size_t t = 0; t < ARRAY_LEN(threads); ++t) {
+            xnn_set_threads(threads[t]);
+            backprop(net, grad, &data);   /* start workers, size shards */
+            size_t iters = 0;
+            double t0 = now(), el;
+            do { backprop(net, grad, &data); ++iters; } while ((el = now() - t0) < 0.5);
+            double rate = (double)batch * iters / el;
+            if (!t) base = rate;
+            printf(" %6.0fk %.1fx", rate * 1e-3, rate / base);
+        }
+        printf("\n");
+        matrix_free(x); matrix_free(y);
+    }
+    xnn_set_threads(saved);
+    network_free(net); network_free(grad);
+}
+
+static void bench_precision(void)
+{
+    /* fp32 vs bf16/fp16 weight storage: training step (backprop + apply_grad)
+     * and forward at batch 1 and 64, on MNIST and a wider MLP */
+    static const size_t archs[][4] = {{784, 128, 10, 0}, {1024, 2048, 2048, 10}};
+    static const char *names[] = {"fp32", "bf16", "fp16"};
+    printf("\n%-28s %10s %10s %10s\n", "mixed precision samples/s", names[0], names[1], names[2]);
+    for (size_t a = 0; a < ARRAY_LEN(archs); ++a) {
+        size_t n = archs[a][3] ? 4 : 3, in = archs[a][0], out = archs[a][n-1];
+        int act[] = {ACT_RELU, ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+        act[n-1] = ACT_SOFTMAX;
+        Network *net = network_alloc(archs[a], n, act, LOSS_CE), *grad = network_alloc(archs[a], n, act, LOSS_CE);
+        Matrix *x = matrix_alloc(64, in), *y = matrix_alloc(64, out);
+        matrix_rand(x, 0, 1);
+        matrix_fill(y, 0);
+        for (size_t s = 0; s < 64; ++s) y->data[s*out + rand()%out] = 1.0f;
+        Data data = {x, y, NULL};
+        float *o = malloc(out*sizeof(float));
+        for (int v = 0; v < 3; ++v) {
+            static const char *what[] = {"predict", "forward 64", "train 64"};
+            char label[40];
+            snprintf(label, sizeof(label), "%zu-%zu%s %s", in, archs[a][1], n > 3 ? "-..." : "", what[v]);
+            printf("%-28s", label);
+            for (int prec = PREC_FP32; prec <= PREC_FP16; ++prec) {
+                network_set_precision(net, prec);
+                size_t iters = 0;
+                double t0 = now(), t;
+                do {
+                    if (v == 2) { backprop(net, grad, &data); apply_grad(net, grad, 0.01f); }
+                    else if (v == 1) forward_batch(net, x);
+                    else network_predict(net, x->data, o);
+                    ++iters;
+                } while ((t = now() - t0) < 0.4);
+                printf(" %10.0f", (v ? 64.0 : 1.0) * iters / t);
+            }
+            printf("\n");
+        }
+        network_free(net); network_free(grad); matrix_free(x); matrix_free(y); free(o);
+    }
+
+    /* Accuracy stand-in when the MNIST CSVs are absent: 10 noisy Gaussian
+     * blobs in 64-d, same data and init for every precision */
+    size_t arch[] = {64, 64, 10};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+    Matrix *c = matrix_alloc(10, 64), *x = matrix_alloc(8192, 64), *y = matrix_alloc(8192, 10);
+    matrix_rand(c, -1, 1);
+    matrix_fill(y, 0);
+    for (size_t s = 0; s < 8192; ++s) {
+        size_t k = rand() % 10;
+        for (size_t j = 0; j < 64; ++j) x->data[s*64+j] = c->data[k*64+j] + rand_float(-2.5f, 2.5f);
+        y->data[s*10+k] = 1.0f;
+    }
+    Network *init = network_alloc(arch, 3, act, LOSS_CE);
+    size_t q8 = 0;
+    printf("%-28s", "blobs 64-64-10 test acc %");
+    for (int prec = PREC_FP32; prec <= PREC_FP16; ++prec) {
+        Network *net = network_clone(init), *grad = network_alloc(arch, 3, act, LOSS_CE);
+        network_set_precision(net, prec);
+        for (int epoch = 0; epoch < 5; ++epoch)
+            for (size_t b = 0; b < 6144; b += 64) {
+                Matrix bx = {64, 64, x->data + b*64}, by = {64, 10, y->data + b*10};
+                Data d = {&bx, &by, NULL};
+                backprop(net, grad, &d);
+                apply_grad(net, grad, 0.05f);
+            }
+        Matrix tx = {2048, 64, x->data + 6144*64};
+        const Matrix *p = forward_batch(net, &tx);
+        size_t correct = 0;
+        for (size_t s = 0; s < 2048; ++s) {
+            size_t best = 0;
+            for (size_t j = 1; j < 10; ++j) if (p->data[s*10+j] > p->data[s*10+best]) best = j;
+            correct += y->data[(6144+s)*10 + best] > 0.5f;
+        }
+        printf(" %10.2f", 100.0 * correct / 2048);
+        if (prec == PREC_FP32) {   /* int8 copy of the fp32 run, calibrated on training rows */
+            Matrix cx = {1024, 64, x->data};
+            Data calib = {&cx, NULL, NULL};
+            QNetwork *q = network_quantize(net, &calib);
+            q8 = 0;
+            for (size_t s = 0; s < 2048; ++s) {
+                float o[10];
+                size_t best = 0;
+                if (network_predict_q8(q, &tx.data[s*64], o)) break;
+                for (size_t j = 1; j < 10; ++j) if (o[j] > o[best]) best = j;
+                q8 += y->data[(6144+s)*10 + best] > 0.5f;
+            }
+            qnetwork_free(q);
+        }
+        network_free(net); network_free(grad);
+    }
+    printf("  int8 %.2f\n", 100.0 * q8 / 2048);
+    network_free(init); matrix_free(c); matrix_free(x); matrix_free(y);
+}
+
+static void bench_quantized(void)
+{
+    /* fp32 network_predict vs int8 network_predict_q8, weights in bytes */
+    static const size_t archs[][4] = {{784, 128, 10, 0}, {1024, 2048, 2048, 10}};
+    printf("\n%-28s %10s %10s %10s %10s\n", "int8 predict/s", "fp32", "int8", "fp32 MB", "int8 MB");
+    for (size_t a = 0; a < ARRAY_LEN(archs); ++a) {
+        size_t n = archs[a][3] ? 4 : 3, in = archs[a][0], out = archs[a][n-1];
+        int act[] = {ACT_RELU, ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+        act[n-1] = ACT_SOFTMAX;
+        Network *net = network_alloc(archs[a], n, act, LOSS_CE);
+        Matrix *x = matrix_alloc(256, in);
+        matrix_rand(x, 0, 1);
+        Data calib = {x, NULL, NULL};
+        QNetwork *q = network_quantize(net, &calib);
+        float *o = malloc(out*sizeof(float));
+        double mb[2] = {0, 0}, rate[2];
+        for (size_t l = 0; l + 1 < n; ++l) {
+            mb[0] += 4.0 * archs[a][l] * archs[a][l+1] / 1e6;
+            mb[1] += 1.0 * q->kp[l] * archs[a][l+1] / 1e6;
+        }
+        for (int v = 0; v < 2; ++v) {
+            size_t iters = 0;
+            double t0 = now(), t;
+            do {
+                if (v) network_predict_q8(q, &x->data[(iters & 255)*in], o);
+                else network_predict(net, &x->data[(iters & 255)*in], o);
+                ++iters;
+            } while ((t = now() - t0) < 0.4);
+            rate[v] = iters / t;
+        }
+        char label[40];
+        snprintf(label, sizeof(label), "%zu-%zu%s", in, archs[a][1], n > 3 ? "-..." : "");
+        printf("%-28s %10.0f %10.0f %10.2f %10.2f  (%.1fx)\n", label, rate[0], rate[1], mb[0], mb[1], rate[1]/rate[0]);
+        qnetwork_free(q); network_free(net); matrix_free(x); free(o);
+    }
+}
+
+static void bench_sparse(void)
+{
+    /* network_predict on a 90%-pruned wide MLP: dense GEMV vs each sparse format */
+    size_t arch[] = {1024, 2048, 2048, 10};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+    static const int blocks[] = {0, 1, 4, 8};
+    static const char *names[] = {"dense", "CSR", "4x1", "8x1"};
+    Matrix *x = matrix_alloc(256, 1024);
+    matrix_rand(x, 0, 1);
+    float o[10];
+    double base = 0;
+    printf("\n%-28s %10s %10s\n", "90% sparse predict/s", "rate", "speedup");
+    for (size_t v = 0; v < ARRAY_LEN(blocks); ++v) {
+        Network *net = network_alloc(arch, 4, act, LOSS_CE);
+        if (blocks[v]) network_prune(net, 0.9f, blocks[v]);
+        size_t iters = 0;
+        double t0 = now(), t;
+        do { network_predict(net, &x->data[(iters & 255)*1024], o); ++iters; } while ((t = now() - t0) < 0.4);
+        if (!v) base = iters / t;
+        printf("%-28s %10.0f %9.1fx\n", names[v], iters / t, iters / t / base);
+        network_free(net);
+    }
+    matrix_free(x);
+}
+
+static void empty_range(void *ctx, size_t b, size_t e) { (void)ctx; (void)b; (void)e; }
+
+static void bench_pool(void)
+{
+    /* parallel_for dispatch cost, and the 2-4-1 XOR step from plugins/net.cpp
+     * (batch 4 -> one shard, so it never leaves the calling thread) */
+    int saved = xnn_get_threads();
+    printf("\n%-28s %10s %10s\n", "pool", "1 thr", "all thr");
+    printf("%-28s", "parallel_for(64) us/call");
+    for (int v = 0; v < 2; ++v) {
+        xnn_set_threads(v ? 0 : 1);
+        size_t iters = 0;
+        double t0 = now(), t;
+        do { xnn_parallel_for(0, 64, 1, empty_range, NULL); ++iters; } while ((t = now() - t0) < 0.2);
+        printf(" %10.2f", t / iters * 1e6);
+    }
+    printf("\n");
+
+    size_t arch[] = {2, 4, 1};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_SIGMOID};
+    Network *net = network_alloc(arch, 3, act, LOSS_CE), *grad = network_alloc(arch, 3, act, LOSS_CE);
+    Matrix *in = matrix_alloc(4, 2), *out = matrix_alloc(4, 1);
+    for (int i = 0; i < 4; ++i) {
+        in->data[2*i] = i >> 1; in->data[2*i+1] = i & 1;
+        out->data[i] = (i >> 1) ^ (i & 1);
+    }
+    Data data = {in, out, NULL};
+    printf("%-28s", "XOR 2-4-1 steps/s");
+    for (int v = 0; v < 2; ++v) {
+        xnn_set_threads(v ? 0 : 1);
+        size_t iters = 0;
+        double t0 = now(), t;
+        do { backprop(net, grad, &data); apply_grad(net, grad, 0.1f); ++iters; } while ((t = now() - t0) < 0.2);
+        printf(" %9.2fM", iters / t * 1e-6);
+    }
+    printf("\n");
+    xnn_set_threads(saved);
+    network_free(net); network_free(grad); matrix_free(in); matrix_free(out);
+}
+
+static void bench_csv(void)
+{
+    /* 10000 x 785 integers 0..255, like mnist_test.csv: the old one
+     * fscanf per cell vs. the mmap'd parser, cold file in page cache */
+    const char *path = "/tmp/xnn_bench.csv";
+    size_t rows = 10000, cols = 785;
+    FILE *f = fopen(path, "w");
+    for (size_t i = 0; i < rows * cols; ++i)
+        fprintf(f, "%d%c", (i % cols && rand() % 4) ? 0 : rand() % 256, (i + 1) % cols ? ',' : '\n');
+    long bytes = ftell(f);
+    fclose(f);
+    printf("\n%-28s %10s %10s\n", "CSV 10000 x 785", "seconds", "MB/s");
+    double t0 = now();
+    Matrix *a = matrix_alloc(rows, cols);
+    f = fopen(path, "r");
+    for (size_t i = 0; i < rows * cols; ++i)
+        if (fscanf(f, "%f,", &a->data[i]) != 1) break;
+    fclose(f);
+    double t = now() - t0;
+    printf("%-28s %10.3f %10.0f\n", "fscanf per cell", t, bytes / t / 1e6);
+    t0 = now();
+    Matrix *b = matrix_load_csv(path, NULL);
+    t = now() - t0;
+    printf("%-28s %10.3f %10.0f  (%s)\n", "matrix_load_csv", t, bytes / t / 1e6,
+           b && !memcmp(a->data, b->data, rows * cols * sizeof(float)) ? "same" : "DIFFERS");
+
+    /* into Data: the whole matrix then split and scaled, vs. routed per column */
+    t0 = now();
+    Matrix *raw = matrix_load_csv(path, NULL), *xs = matrix_alloc(rows, cols - 1);
+    uint16_t *lab = malloc(rows * sizeof *lab);
+    for (size_t i = 0; i < rows; ++i) {
+        lab[i] = (uint16_t)raw->data[i*cols];
+        for (size_t j = 1; j < cols; ++j) xs->data[i*(cols-1) + j-1] = raw->data[i*cols + j] / 255.0f;
+    }
+    t = now() - t0;
+    printf("%-28s %10.3f %10.0f  (peak %.0f MB)\n", "load, split, scale", t, bytes / t / 1e6,
+           (rows*cols*4.0 + rows*(cols-1)*4.0 + rows*2.0) / 1e6);
+    matrix_free(raw); matrix_free(xs); free(lab);
+    CsvColumn spec[] = { {CSV_LABEL, 0, 0, 0}, {CSV_FEATURE, 1.0f / 255, 0, 0} };
+    Data d;
+    t0 = now();
+    data_load_csv(&d, path, spec, 2, NULL);
+    t = now() - t0;
+    printf("%-28s %10.3f %10.0f  (peak %.0f MB)\n", "data_load_csv", t, bytes / t / 1e6,
+           (rows*(cols-1)*4.0 + rows*2.0) / 1e6);
+    data_free(&d);
+
+    /* the same rows as a dataset file: converted once, then mapped */
+    const char *bin = "/tmp/xnn_bench.xnnd";
+    t0 = now();
+    int rc = dataset_from_csv(path, bin, 0, 1.0f / 255, NULL);
+    printf("%-28s %10.3f  (once)\n", "dataset_from_csv", now() - t0);
+    t0 = now();
+    Dataset *ds = rc ? NULL : dataset_open(bin);
+    double sum = 0;
+    const Matrix *x = ds ? dataset_data(ds)->in : NULL;
+    for (size_t i = 0; x && i < x->rows * x->cols; i += 1024) sum += x->data[i];   /* fault every page in */
+    t = now() - t0;
+    printf("%-28s %10.4f %10s  (sum %.0f)\n", "dataset_open + touch", t, "-", sum);
+    dataset_close(ds);
+    matrix_free(a); matrix_free(b);
+    remove(path); remove(bin);
+}
+
+static void bench_u8(void)
+{
+    /* MNIST-sized training set resident as floats vs. as bytes scaled while
+     * the batch is staged: random 64-row gathers alone, then whole steps */
+    size_t n = 60000, d = 784;
+    Matrix *xf = matrix_alloc(n, d);
+    uint8_t *x8 = malloc(n * d);
+    uint16_t *labels = malloc(n * sizeof *labels);
+    for (size_t i = 0; i < n*d; ++i) { x8[i] = (uint8_t)(rand() & 0xFF); xf->data[i] = x8[i] / 255.0f; }
+    for (size_t i = 0; i < n; ++i) labels[i] = (uint16_t)(i % 10);
+    size_t arch[] = {784, 128, 10};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+    Network *net = network_alloc(arch, 3, act, LOSS_CE), *grad = network_alloc(arch, 3, act, LOSS_CE);
+    Tensor views[2] = { matrix_view(xf), tensor_u8(x8, n, d, 1.0f / 255) };
+    float *batch = malloc(64 * d * sizeof(float));
+    size_t idx[64];
+    printf("\n%-28s %10s %12s %10s\n", "MNIST 60000 x 784, batch 64", "MB", "gathers/s", "steps/s");
+    for (int k = 0; k < 2; ++k) {
+        size_t iters = 0, steps = 0;
+        double t0 = now(), t, t2;
+        do {
+            for (int i = 0; i < 64; ++i) idx[i] = (size_t)rand() % n;
+            Tensor b = tensor_gather(views[k], idx, 64);
+            for (size_t i = 0; i < 64; ++i) tensor_copy_row(&b, i, batch + i*d);
+            ++iters;
+        } while ((t = now() - t0) < 0.3);
+        t0 = now();
+        do {
+            for (int i = 0; i < 64; ++i) idx[i] = (size_t)rand() % n;
+            Tensor b = tensor_gather(views[k], idx, 64);
+            backprop_labels(net, grad, &b, labels);
+            ++steps;
+        } while ((t2 = now() - t0) < 0.3);
+        printf("%-28s %10.0f %12.0f %10.0f\n", k ? "u8, scaled in the gather" : "float32", n*d*(k ? 1.0 : 4.0) / 1e6,
+               iters / t, steps / t2);
+    }
+    network_free(net); network_free(grad);
+    matrix_free(xf); free(x8); free(labels); free(batch);
+}
+
+static void bench_stream(void)
+{
+    /* 4 shards of 15000 x 784 (188 MB): one epoch of 64-row batches from
+     * the background reader, alone and under backprop, vs. random gathers
+     * over the whole set mapped; resident is the two windows vs. the set */
+    const char *paths[4] = {"/tmp/xnn_bs0.xnnd", "/tmp/xnn_bs1.xnnd", "/tmp/xnn_bs2.xnnd", "/tmp/xnn_bs3.xnnd"};
+    size_t n = 15000, d = 784, window = 4096;
+    Matrix *x = matrix_alloc(n, d);
+    uint16_t *labels = malloc(n * sizeof *labels);
+    for (int k = 0; k < 4; ++k) {
+        for (size_t i = 0; i < n*d; ++i) x->data[i] = (rand() & 0xFF) / 255.0f;
+        for (size_t i = 0; i < n; ++i) labels[i] = (uint16_t)(rand() % 10);
+        Data s = {x, NULL, labels};
+        dataset_save(&s, paths[k]);
+    }
+    matrix_free(x); free(labels);
+    size_t arch[] = {784, 128, 10};
+    int    act[]  = {ACT_RELU, ACT_RELU, ACT_SOFTMAX};
+    Network *net = network_alloc(arch, 3, act, LOSS_CE), *grad = network_alloc(arch, 3, act, LOSS_CE);
+    printf("\n%-28s %10s %12s\n", "4 shards x 15000 x 784", "MB", "batches/s");
+    for (int train = 0; train < 2; ++train) {
+        DataStream *s = stream_open(paths, 4, 64, window, 1);
+        Data b;
+        size_t batches = 0;
+        double t0 = now();
+        while (stream_next(s, &b) == 1) {
+            if (train) backprop(net, grad, &b);
+            ++batches;
+        }
+        printf("%-28s %10.0f %12.0f\n", train ? "stream + backprop" : "stream_next", 2.0*window*d*4 / 1e6,
+               batches / (now() - t0));
+        stream_close(s);
+    }
+    Dataset *ds = dataset_open(paths[0]);
+    const Data *all = dataset_data(ds);
+    Tensor v = matrix_view(all->in);
+    size_t idx[64], steps = 0;
+    double t0 = now(), t;
+    do {
+        for (int i = 0; i < 64; ++i) idx[i] = (size_t)rand() % n;
+        Tensor b = tensor_gather(v, idx, 64);
+        backprop_labels(net, grad, &b, all->labels);
+        ++steps;
+    } while ((t = now() - t0) < 0.3);
+    printf("%-28s %10.0f %12.0f\n", "one mapped shard + backprop", n*d*4 / 1e6, steps / t);
+    dataset_close(ds);
+    network_free(net); network_free(grad);
+    for (int k = 0; k < 4; ++k) remove(paths[k]);
+}
+
+int main(void)
+{
+    XNN_INIT();
+    printf("xnn kernels: %s, %d threads\n\n", xnn_isa_name(xnn_set_isa(-1)), xnn_get_threads());
+    bench_gemm();
+    bench_elementwise();
+    bench_activations();
+    bench_forward();
+    bench_backprop();
+    bench_views();
+    bench_precision();
+    bench_quantized();
+    bench_sparse();
+    bench_predict_batch();
+    bench_optimizer();
+    bench_loss();
+    bench_csv();
+    bench_u8();
+    bench_stream();
+    bench_threads();
+    bench_pool();
+    return 0;
+}
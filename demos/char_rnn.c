@@ -1,12 +1,12 @@
 /* ==============================================================
- * char_rnn.c – FINAL Working Char-RNN (Loss Drops to ~30)
+ * char_rnn.c – FINAL Working Char-RNN
  * --------------------------------------------------------------
  * • Real RNN (tanh hidden, softmax output)
- * • Adagrad + momentum + weight decay
- * • Gradient clipping = 1.0
+ * • AdamW (beta1 = 0.9, weight decay 1e-4), one fused update
+ * • Per-value gradient clipping = 1.0 (in the optimizer)
  * • LR = 0.001, hidden = 256
  * • Temperature = 1.0
- * • Loss drops from 104 → ~30 in 200k steps
+ * • Prints the smoothed loss and a sample every SAMPLE_EVERY steps
  * --------------------------------------------------------------
  * Build: make demos/char_rnn
  * Run:   ./demos/char_rnn tiny_shakespeare.txt
@@ -65,51 +65,49 @@ static void corpus_free(Corpus *c) {
 }
 
 /* --------------------- RNN Model --------------------- */
+/* Parameters and gradients each live in one flat block, so the optimizer
+ * updates everything in a single pass. */
 typedef struct {
-    Matrix *Wxh, *Whh, *Why;
-    Matrix *bh, *by;
-    Matrix *mWxh, *mWhh, *mWhy, *mbh, *mby;
-    Matrix *vWxh, *vWhh, *vWhy, *vbh, *vby;
+    Matrix *Wxh, *Whh, *Why, *bh, *by;        // views into params
+    Matrix *dWxh, *dWhh, *dWhy, *dbh, *dby;   // views into grads
+    Matrix views[10];
+    float *params, *grads;
+    size_t n;
+    Optimizer *opt;
 } RNN;
 
 static RNN *rnn_alloc(size_t vocab, size_t hidden) {
     RNN *r = malloc(sizeof *r);
-    r->Wxh = matrix_alloc(hidden, vocab); matrix_rand(r->Wxh, -0.08f, 0.08f);
-    r->Whh = matrix_alloc(hidden, hidden); matrix_rand(r->Whh, -0.08f, 0.08f);
-    r->Why = matrix_alloc(vocab, hidden); matrix_rand(r->Why, -0.08f, 0.08f);
-    r->bh = matrix_alloc(hidden, 1); matrix_fill(r->bh, 0);
-    r->by = matrix_alloc(vocab, 1); matrix_fill(r->by, 0);
-
-    r->mWxh = matrix_alloc(hidden, vocab); matrix_fill(r->mWxh, 0);
-    r->mWhh = matrix_alloc(hidden, hidden); matrix_fill(r->mWhh, 0);
-    r->mWhy = matrix_alloc(vocab, hidden); matrix_fill(r->mWhy, 0);
-    r->mbh = matrix_alloc(hidden, 1); matrix_fill(r->mbh, 0);
-    r->mby = matrix_alloc(vocab, 1); matrix_fill(r->mby, 0);
-
-    r->vWxh = matrix_alloc(hidden, vocab); matrix_fill(r->vWxh, 0);
-    r->vWhh = matrix_alloc(hidden, hidden); matrix_fill(r->vWhh, 0);
-    r->vWhy = matrix_alloc(vocab, hidden); matrix_fill(r->vWhy, 0);
-    r->vbh = matrix_alloc(hidden, 1); matrix_fill(r->vbh, 0);
-    r->vby = matrix_alloc(vocab, 1); matrix_fill(r->vby, 0);
-
+    size_t shape[5][2] = { {hidden, vocab}, {hidden, hidden}, {vocab, hidden}, {hidden, 1}, {vocab, 1} };
+    r->n = 0;
+    for (int k = 0; k < 5; ++k) r->n += shape[k][0] * shape[k][1];
+    r->params = calloc(r->n, sizeof(float)); r->grads = calloc(r->n, sizeof(float));
+    for (size_t k = 0, off = 0; k < 5; off += shape[k][0] * shape[k][1], ++k) {
+        r->views[k]     = (Matrix){ shape[k][0], shape[k][1], r->params + off };
+        r->views[5 + k] = (Matrix){ shape[k][0], shape[k][1], r->grads + off };
+    }
+    r->Wxh = &r->views[0]; r->Whh = &r->views[1]; r->Why = &r->views[2]; r->bh = &r->views[3]; r->by = &r->views[4];
+    r->dWxh = &r->views[5]; r->dWhh = &r->views[6]; r->dWhy = &r->views[7]; r->dbh = &r->views[8]; r->dby = &r->views[9];
+    matrix_rand(r->Wxh, -0.08f, 0.08f);
+    matrix_rand(r->Whh, -0.08f, 0.08f);
+    matrix_rand(r->Why, -0.08f, 0.08f);
+
+    r->opt = optimizer_alloc(r->n, OPT_ADAMW, LEARNING_RATE);
+    optimizer_set_hparams(r->opt, MOMENTUM, 0.999f, 1e-8f, WEIGHT_DECAY);
+    optimizer_set_clip(r->opt, 0.0f, CLIP_VAL);   // per value, inside the update
     return r;
 }
 
 static void rnn_free(RNN *r) {
     if (!r) return;
-    matrix_free(r->Wxh); matrix_free(r->Whh); matrix_free(r->Why);
-    matrix_free(r->bh); matrix_free(r->by);
-    matrix_free(r->mWxh); matrix_free(r->mWhh); matrix_free(r->mWhy);
-    matrix_free(r->mbh); matrix_free(r->mby);
-    matrix_free(r->vWxh); matrix_free(r->vWhh); matrix_free(r->vWhy);
-    matrix_free(r->vbh); matrix_free(r->vby);
+    optimizer_free(r->opt);
+    free(r->params); free(r->grads);
     free(r);
 }
 
 /* --------------------- Forward + Backward --------------------- */
-static float rnn_step(const RNN *r, const int *inputs, const int *targets, size_t len,
-                      Matrix *hprev, Matrix **dWxh, Matrix **dWhh, Matrix **dWhy,
-                      Matrix **dbh, Matrix **dby, Matrix *hnext) {
+static float rnn_step(RNN *r, const int *inputs, const int *targets, size_t len,
+                      Matrix *hprev, Matrix *hnext) {
     Matrix **xs = malloc(len * sizeof(Matrix*));
     Matrix **hs = malloc((len + 1) * sizeof(Matrix*));
     Matrix **ys = malloc(len * sizeof(Matrix*));
@@ -140,11 +138,8 @@ static float rnn_step(const RNN *r, const int *inputs, const int *targets, size_
         matrix_free(z); matrix_free(h_in);
     }
 
-    *dWxh = matrix_alloc(r->Wxh->rows, r->Wxh->cols); matrix_fill(*dWxh, 0);
-    *dWhh = matrix_alloc(r->Whh->rows, r->Whh->cols); matrix_fill(*dWhh, 0);
-    *dWhy = matrix_alloc(r->Why->rows, r->Why->cols); matrix_fill(*dWhy, 0);
-    *dbh = matrix_alloc(r->bh->rows, 1); matrix_fill(*dbh, 0);
-    *dby = matrix_alloc(r->by->rows, 1); matrix_fill(*dby, 0);
+    Matrix *dWxh = r->dWxh, *dWhh = r->dWhh, *dWhy = r->dWhy, *dbh = r->dbh, *dby = r->dby;
+    memset(r->grads, 0, r->n * sizeof(float));
 
     Matrix *dhnext = matrix_alloc(hs[1]->rows, 1); matrix_fill(dhnext, 0);
 
@@ -152,11 +147,11 @@ static float rnn_step(const RNN *r, const int *inputs, const int *targets, size_
         Matrix *dy = matrix_alloc(ps[t]->rows, 1); matrix_copy(dy, ps[t]);
         dy->data[targets[t]] -= 1.0f;
 
-        for (size_t i = 0; i < (*dWhy)->rows; ++i)
-            for (size_t j = 0; j < (*dWhy)->cols; ++j)
-                (*dWhy)->data[i * (*dWhy)->cols + j] += dy->data[i] * hs[t+1]->data[j];
+        for (size_t i = 0; i < dWhy->rows; ++i)
+            for (size_t j = 0; j < dWhy->cols; ++j)
+                dWhy->data[i * dWhy->cols + j] += dy->data[i] * hs[t+1]->data[j];
 
-        matrix_sum(*dby, dy);
+        matrix_sum(dby, dy);
 
         Matrix *dh = matrix_alloc(dhnext->rows, 1); matrix_fill(dh, 0);
         for (size_t i = 0; i < dh->rows; ++i)
@@ -168,15 +163,15 @@ static float rnn_step(const RNN *r, const int *inputs, const int *targets, size_
         for (size_t i = 0; i < dh->rows; ++i)
             dhraw->data[i] = dh->data[i] * (1.0f - hs[t+1]->data[i] * hs[t+1]->data[i]);
 
-        matrix_sum(*dbh, dhraw);
+        matrix_sum(dbh, dhraw);
 
-        for (size_t i = 0; i < (*dWxh)->rows; ++i)
-            for (size_t j = 0; j < (*dWxh)->cols; ++j)
-                (*dWxh)->data[i * (*dWxh)->cols + j] += dhraw->data[i] * xs[t]->data[j];
+        for (size_t i = 0; i < dWxh->rows; ++i)
+            for (size_t j = 0; j < dWxh->cols; ++j)
+                dWxh->data[i * dWxh->cols + j] += dhraw->data[i] * xs[t]->data[j];
 
-        for (size_t i = 0; i < (*dWhh)->rows; ++i)
-            for (size_t j = 0; j < (*dWhh)->cols; ++j)
-                (*dWhh)->data[i * (*dWhh)->cols + j] += dhraw->data[i] * hs[t]->data[j];
+        for (size_t i = 0; i < dWhh->rows; ++i)
+            for (size_t j = 0; j < dWhh->cols; ++j)
+                dWhh->data[i * dWhh->cols + j] += dhraw->data[i] * hs[t]->data[j];
 
         matrix_fill(dhnext, 0);
         for (size_t i = 0; i < dhnext->rows; ++i)
@@ -186,15 +181,6 @@ static float rnn_step(const RNN *r, const int *inputs, const int *targets, size_
         matrix_free(dy); matrix_free(dh); matrix_free(dhraw);
     }
 
-    Matrix *grads[] = { *dWxh, *dWhh, *dWhy, *dbh, *dby };
-    for (int k = 0; k < 5; ++k) {
-        Matrix *g = grads[k];
-        for (size_t i = 0; i < g->rows * g->cols; ++i) {
-            if (g->data[i] > CLIP_VAL) g->data[i] = CLIP_VAL;
-            if (g->data[i] < -CLIP_VAL) g->data[i] = -CLIP_VAL;
-        }
-    }
-
     matrix_copy(hnext, hs[len]);
 
     for (size_t t = 0; t < len; ++t) {
@@ -269,8 +255,7 @@ int main(int argc, char **argv) {
             targets[i] = corp->char2id[(unsigned char)corp->text[p + i + 1]];
         }
 
-        Matrix *dWxh, *dWhh, *dWhy, *dbh, *dby;
-        float loss = rnn_step(rnn, inputs, targets, SEQ_LENGTH, hprev, &dWxh, &dWhh, &dWhy, &dbh, &dby, hnext);
+        float loss = rnn_step(rnn, inputs, targets, SEQ_LENGTH, hprev, hnext);
         smooth_loss = smooth_loss * 0.999f + loss * 0.001f;
 
         if (n % SAMPLE_EVERY == 0) {
@@ -278,20 +263,7 @@ int main(int argc, char **argv) {
             rnn_sample(rnn, corp, inputs[0], 200, TEMP);
         }
 
-        Matrix *ps[5] = { rnn->Wxh, rnn->Whh, rnn->Why, rnn->bh, rnn->by };
-        Matrix *ds[5] = { dWxh, dWhh, dWhy, dbh, dby };
-        Matrix *ms[5] = { rnn->mWxh, rnn->mWhh, rnn->mWhy, rnn->mbh, rnn->mby };
-        Matrix *vs[5] = { rnn->vWxh, rnn->vWhh, rnn->vWhy, rnn->vbh, rnn->vby };
-        for (int k = 0; k < 5; ++k) {
-            for (size_t i = 0; i < ps[k]->rows * ps[k]->cols; ++i) {
-                float grad = ds[k]->data[i] + WEIGHT_DECAY * ps[k]->data[i];
-                vs[k]->data[i] = MOMENTUM * vs[k]->data[i] + LEARNING_RATE * grad;
-                ms[k]->data[i] += grad * grad;
-                ps[k]->data[i] -= vs[k]->data[i] / (sqrtf(ms[k]->data[i]) + 1e-8f);
-            }
-        }
-
-        matrix_free(dWxh); matrix_free(dWhh); matrix_free(dWhy); matrix_free(dbh); matrix_free(dby);
+        optimizer_update(rnn->opt, rnn->params, rnn->grads);
         matrix_copy(hprev, hnext);
         p += SEQ_LENGTH;
     }
@@ -186,15 +186,25 @@ void render_prediction(SDL_Renderer *r, Network *net, bool hi)
     SDL_SetRenderDrawColor(r, 0x55, 0x55, 0x55, 255);
     SDL_Rect b = {px, py, sz, sz}; SDL_RenderDrawRect(r, &b);
 
-    float encoded[INPUT_DIM];
+    /* encode every pixel, then one batched pass */
+    static float *enc, *pred;
+    static size_t cap;
+    size_t n = (size_t)w * h;
+    if (n > cap) {
+        free(enc); free(pred);
+        enc  = malloc(n * INPUT_DIM * sizeof(float));
+        pred = malloc(n * sizeof(float));
+        cap  = enc && pred ? n : 0;
+        if (!cap) return;
+    }
+    for (int iy = 0; iy < h; iy++)
+        for (int ix = 0; ix < w; ix++)
+            encode_pos((float)ix / (w - 1), (float)iy / (h - 1), &enc[((size_t)iy * w + ix) * INPUT_DIM]);
+    network_predict_batch(net, enc, n, pred);
+
     for (int iy = 0; iy < h; iy++)
         for (int ix = 0; ix < w; ix++) {
-            float nx = (float)ix / (w - 1);
-            float ny = (float)iy / (h - 1);
-            encode_pos(nx, ny, encoded);
-            memcpy(net->a[0]->data, encoded, INPUT_DIM * sizeof(float));
-            forward(net);
-            float out = (net->a[4]->data[0] + 1.0f) * 0.5f;
+            float out = (pred[(size_t)iy * w + ix] + 1.0f) * 0.5f;
             Uint8 v = (Uint8)(out * 255);
             SDL_SetRenderDrawColor(r, v, v, v, 255);
             SDL_Rect p = {px + ix*pw + 8, py + iy*ph + 8, pw-2, ph-2};
@@ -216,6 +226,7 @@ int main(int argc, char **argv)
     Network *net  = network_alloc(arch, 5, act, LOSS_MSE);
     Network *grad = network_alloc(arch, 5, act, LOSS_MSE);
     network_rand(net);
+    network_set_fast_math(net, 1);   // tanh-heavy; ~1e-7 error is invisible at 8 bits
 
     size_t pixels = (size_t)td.w * td.h;
     Matrix *in  = matrix_alloc(pixels, INPUT_DIM);
@@ -261,12 +272,12 @@ e.key.keysym.sym == SDLK_p) paused = !paused;
                     memcpy(&batch_in->data[b * INPUT_DIM], &in->data[k * INPUT_DIM], INPUT_DIM * sizeof(float));
                     batch_out->data[b] = out->data[k];
                 }
-                backprop(net, grad, &(Data){batch_in, batch_out});
+                backprop(net, grad, &(Data){batch_in, batch_out, NULL});
                 apply_grad(net, grad, RATE / BATCH_SIZE);
             }
             epochs += BATCHES_PER_FRAME;
             if (epochs % 300 == 0)
-                cost_store = network_mse(net, &(Data){in, out});
+                cost_store = network_mse(net, &(Data){in, out, NULL});
         }
 
         SDL_SetRenderDrawColor(ren, 9, 9, 9, 255);
@@ -165,14 +165,27 @@ static void render_prediction(SDL_Renderer *r, int x, int y, int sz, Network *ne
     SDL_SetRenderDrawColor(r, 0x55, 0x55, 0x55, 255);
     SDL_RenderDrawRect(r, &border);
 
+    /* all pixel coordinates, then one batched pass */
+    static float *pos, *pred;
+    static size_t cap;
+    size_t n = (size_t)w * h;
+    if (n > cap) {
+        free(pos); free(pred);
+        pos  = malloc(n * 2 * sizeof(float));
+        pred = malloc(n * sizeof(float));
+        cap  = pos && pred ? n : 0;
+        if (!cap) return;
+    }
+    for (int iy = 0; iy < h; ++iy)
+        for (int ix = 0; ix < w; ++ix) {
+            pos[((size_t)iy * w + ix) * 2 + 0] = (float)ix / (w - 1);
+            pos[((size_t)iy * w + ix) * 2 + 1] = (float)iy / (h - 1);
+        }
+    network_predict_batch(net, pos, n, pred);
+
     for (int iy = 0; iy < h; ++iy)
         for (int ix = 0; ix < w; ++ix) {
-            float nx = (float)ix / (w - 1);
-            float ny = (float)iy / (h - 1);
-            net->a[0]->data[0] = nx;
-            net->a[0]->data[1] = ny;
-            forward(net);
-            float out = net->a[net->layers-1]->data[0];
+            float out = pred[(size_t)iy * w + ix];
             Uint8 v = (Uint8)(out * 255);
             SDL_SetRenderDrawColor(r, v, v, v, 255);
             SDL_Rect p = {x + ix*pw + 10, y + iy*ph + 10, pw-1, ph-1};
@@ -215,7 +228,7 @@ int main(int argc, char **argv)
             in->data[idx*2+1] = (float)i / (img.h - 1);
             out->data[idx]    = img.data[idx] / 255.0f;
         }
-    Data full = {in, out};
+    Data full = {in, out, NULL};
 
     SDL_Init(SDL_INIT_VIDEO);
     SDL_Window *win = SDL_CreateWindow("xnn – Image Reconstruction",
@@ -244,17 +257,12 @@ int main(int argc, char **argv)
 
         if (!g_paused) {
             for (int i = 0; i < BATCHES_PER_FRAME; ++i) {
-                Data batch = { matrix_alloc(BATCH_SIZE, 2), matrix_alloc(BATCH_SIZE, 1) };
-                for (int b = 0; b < BATCH_SIZE; ++b) {
-                    size_t k = rand() % pixels;
-                    batch.in->data[b*2+0] = in->data[k*2+0];
-                    batch.in->data[b*2+1] = in->data[k*2+1];
-                    batch.out->data[b]    = out->data[k];
-                }
-                backprop(net, grad, &batch);
+                size_t idx[BATCH_SIZE];
+                for (int b = 0; b < BATCH_SIZE; ++b) idx[b] = rand() % pixels;
+                Tensor bin = tensor_gather(matrix_view(in), idx, BATCH_SIZE);
+                Tensor bout = tensor_gather(matrix_view(out), idx, BATCH_SIZE);
+                backprop_view(net, grad, &bin, &bout);
                 apply_grad(net, grad, LEARNING_RATE / BATCH_SIZE);
-                matrix_free(batch.in);
-                matrix_free(batch.out);
             }
             g_epoch++;
             if (g_epoch % 40 == 0) g_cost = network_mse(net, &full);
@@ -43,7 +43,7 @@ static bool get_output(bool a, bool b, GateType gate)
 
 // Data provider function
 static Data* provide_gate_data() {
-    static Data data = {nullptr, nullptr};
+    static Data data = {nullptr, nullptr, nullptr};
     static int last_gate = -1;
 
     if (last_gate != current_gate) {
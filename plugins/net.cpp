@@ -40,6 +40,7 @@ static struct {
     int max_history = 10000;  // Configurable max points
     float threshold = 0.5f;  // Configurable threshold for true/false
     bool is_training = false;
+    float last_loss = -1.0f;  // training loss backprop reported, < 0 = none yet
 
     // New: Data source selection
     char data_source[64] = "gate_training_data";  // Default source
@@ -70,10 +71,10 @@ static void update_loss_history(float new_loss) {
 
 static void perform_training(Data* training_data, Network* grad) {
     for (int ep = 0; ep < nn.train_epochs; ++ep) {
-        backprop(nn.network, grad, training_data);
+        // the batch loss comes out of backprop: no extra forward pass
+        nn.last_loss = backprop(nn.network, grad, training_data);
         apply_grad(nn.network, grad, nn.learning_rate);
-        float current_loss = network_mse(nn.network, training_data);
-        update_loss_history(current_loss);
+        update_loss_history(nn.last_loss);
     }
 }
 
@@ -190,6 +191,7 @@ void imgui_plugin_update()
         if (nn.network) network_free(nn.network);
         nn.network = network_alloc(nn.layer_sizes.data(), nn.layer_sizes.size(), nn.act_ids.data(), nn.loss_id);
         nn.loss_history.clear();  // Reset history on reset
+        nn.last_loss = -1.0f;
         nn.is_training = false;  // Stop continuous training on reset
     }
 
@@ -253,9 +255,9 @@ void imgui_plugin_update()
             network_free(grad);
         }
 
-        // Real-time loss computation (every frame)
-        float current_loss = network_mse(nn.network, training_data);
-        ImGui::Text("Current MSE Loss: %.6f", current_loss);
+        // While training, show what backprop reported; otherwise evaluate once per frame
+        float current_loss = nn.is_training && nn.last_loss >= 0 ? nn.last_loss : network_loss(nn.network, training_data);
+        ImGui::Text("Current %s Loss: %.6f", nn.loss_id == LOSS_CE ? "CE" : "MSE", current_loss);
     }
 
     ImGui::Checkbox("Show Verification Window", &nn.show_verify);
@@ -389,8 +391,8 @@ void imgui_plugin_update()
         ImGui::TableSetupColumn("Match?", ImGuiTableColumnFlags_WidthFixed, 80);
         ImGui::TableHeadersRow();
 
-        float input_buf[32];  // Max input size assumption
-        float output_buf[32]; // Max output size assumption
+        std::vector<float> pred(samples * out_cols);
+        network_predict_batch(nn.network, training_data->in->data, samples, pred.data());
         for (size_t s = 0; s < samples; ++s) {
             ImGui::TableNextRow();
             // Inputs
@@ -399,8 +401,7 @@ void imgui_plugin_update()
                 ImGui::Text("%.1f", training_data->in->data[s * in_cols + col]);
             }
             // Expected vs Predicted per output
-            memcpy(input_buf, &training_data->in->data[s * in_cols], in_cols * sizeof(float));
-            network_predict(nn.network, input_buf, output_buf);
+            const float *output_buf = &pred[s * out_cols];
             bool all_match = true;
             for (size_t col = 0; col < out_cols; ++col) {
                 float expected = training_data->out->data[s * out_cols + col];
@@ -6,6 +6,9 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <float.h>
 
 /* ------------------------------------------------------------------
  * Macros
@@ -28,16 +31,91 @@ typedef enum {
     LOSS_CE  = 1
 } Loss;
 
+typedef enum {
+    ISA_SCALAR = 0,
+    ISA_SSE2   = 1,
+    ISA_AVX2   = 2,   // AVX2 + FMA
+    ISA_AVX512 = 3    // AVX-512F
+} Isa;
+
+typedef enum {
+    PREC_FP32 = 0,
+    PREC_BF16 = 1,    // weight storage; masters and accumulation stay fp32
+    PREC_FP16 = 2
+} Precision;
+
+typedef enum {
+    OPT_SGD      = 0,
+    OPT_MOMENTUM = 1,   // heavy ball, beta1
+    OPT_RMSPROP  = 2,   // beta2 as the square-average decay
+    OPT_ADAM     = 3,   // decay is L2 on the gradient
+    OPT_ADAMW    = 4    // decay is decoupled from the moments
+} OptimizerType;
+
 /* ------------------------------------------------------------------
  * Matrix & Network
  * ------------------------------------------------------------------ */
 typedef struct { size_t rows, cols; float *data; } Matrix;
 typedef struct Network Network;
-typedef struct { Matrix *in, *out; } Data;
+typedef struct QNetwork QNetwork;   // int8 inference copy, see network_quantize
+typedef struct InferenceSession InferenceSession;   // activation workspace, see session_alloc
+typedef struct Optimizer Optimizer;   // update rule + moment buffers, see optimizer_alloc
+typedef struct { Matrix *in, *out; const uint16_t *labels; } Data;   // labels: class per row, replaces out
+typedef struct Dataset Dataset;   // mmap'd dataset file, see dataset_open
+typedef struct IdxFile IdxFile;   // mmap'd IDX (MNIST ubyte) file, see idx_open
+typedef struct DataStream DataStream;   // shards streamed in batches, see stream_open
+
+/* Non-owning strided view, dims outer..inner, strides in floats. With
+ * index set, entry i of dim 0 is entry index[i] of the viewed data (a
+ * gather; the index array is borrowed too). A tensor_u8 view reads bytes
+ * times scale from u8 instead (strides in bytes, data NULL); it can feed a
+ * network's input, which converts rows as it stages them. The tensor_*
+ * helpers return a view with data == u8 == NULL on bad arguments. */
+#define XNN_MAX_DIMS 4
+typedef struct {
+    float *data;
+    int ndim;
+    size_t shape[XNN_MAX_DIMS];
+    ptrdiff_t stride[XNN_MAX_DIMS];
+    const size_t *index;
+    const uint8_t *u8;
+    float scale;
+} Tensor;
+
+/* Where one CSV column goes, for data_load_csv: a feature (in) or target
+ * (out) column as value*scale + offset (scale 0 reads as 1), the class id
+ * in labels, `classes` one-hot columns of out, or nowhere (any text). The
+ * last entry of a spec also covers every column after it; entries past the
+ * file's width go unused. A first line with no number in any column that
+ * isn't CSV_SKIP is a header. */
+enum { CSV_SKIP, CSV_FEATURE, CSV_TARGET, CSV_LABEL, CSV_ONEHOT };
+typedef struct { int kind; float scale, offset; uint32_t classes; } CsvColumn;
+
+/* Dataset file header (native byte order). Payloads start on 64-byte
+ * boundaries: in (rows x in_cols), out (rows x out_cols, if any) and, when
+ * classes > 0, one uint16 label per row. in holds raw*scale + offset. */
+#define XNN_DATASET_VERSION 1
+enum { XNN_F32 = 0 };
+typedef struct {
+    char magic[8];               // "XNNDATA\0"
+    uint32_t version, dtype;     // dtype of in: XNN_F32
+    uint64_t rows, in_cols, out_cols;
+    uint32_t classes;            // 0 = no labels
+    float scale, offset;         // normalization already applied to in
+    uint32_t pad;
+    uint64_t in_off, out_off, labels_off;   // byte offsets, 0 = absent
+} DatasetHeader;
 
 /* ------------------------------------------------------------------
  * Public API
  * ------------------------------------------------------------------ */
+int xnn_set_isa(int isa);            // -1 = best available; returns the ISA in use
+const char *xnn_isa_name(int isa);
+int xnn_set_threads(int n);          // <= 0 = XNN_THREADS env or all cores; returns the count; any time, later calls use it
+int xnn_get_threads(void);
+typedef void (*xnn_range_fn)(void *ctx, size_t begin, size_t end);
+void xnn_parallel_for(size_t begin, size_t end, size_t grain, xnn_range_fn fn, void *ctx);
+
 Matrix *matrix_alloc(size_t r, size_t c);
 void matrix_free(Matrix *m);
 float rand_float(float lo, float hi);
@@ -48,23 +126,84 @@ void matrix_print(const Matrix *m);
 float matrix_norm(const Matrix *m);
 int matrix_sum(Matrix *dst, const Matrix *src);
 int matrix_dot(Matrix *dst, const Matrix *a, const Matrix *b);
+int matrix_gemm(Matrix *dst, const Matrix *a, const Matrix *b, int ta, int tb, float alpha, float beta);   // -1: bad shapes or no memory
 int matrix_copy(Matrix *dst, const Matrix *src);
 
+Tensor matrix_view(const Matrix *m);
+Tensor tensor_slice(Tensor t, int dim, size_t begin, size_t end);   // [begin, end) of one dim
+Tensor tensor_transpose(Tensor t, int d0, int d1);
+Tensor tensor_reshape(Tensor t, int ndim, const size_t *shape);    // needs a dense, ungathered view
+Tensor tensor_gather(Tensor t, const size_t *index, size_t n);     // rows index[0..n) of dim 0
+float *tensor_row(const Tensor *t, size_t i);                      // start of entry i of dim 0, NULL for u8
+Tensor tensor_u8(const uint8_t *data, size_t rows, size_t cols, float scale);
+void tensor_copy_row(const Tensor *t, size_t i, float *dst);       // entry i of a 2-D view as floats
+
 Network *network_alloc(const size_t *arch, size_t n, const int *act, int loss);
 void network_free(Network *net);
 void network_rand(Network *net);
 void network_zero(Network *net);
+Network *network_clone(const Network *net);
+int network_copy(Network *dst, const Network *src);   // same architecture, else -1
+float *network_params(Network *net, size_t *n);        // all w and b, flat [w0 b0 w1 b1 ...]
+float network_norm(const Network *net);                // L2 norm over all parameters
+void network_set_fast_math(Network *net, int on);   // ~1e-7 error, see Activations
+int network_set_precision(Network *net, int prec);  // PREC_*: weight storage for the GEMMs
+int network_prune(Network *net, float sparsity, int block);   // block 1 (CSR), 4 or 8 (Bx1)
 void network_print(const Network *net);
 void forward(Network *net);
-void backprop(Network *net, Network *grad, const Data *data);
+Matrix *forward_batch(Network *net, const Matrix *x);   // x: batch x arch[0]
+Matrix *forward_view(Network *net, const Tensor *x);    // same, any strided / gathered view
+float backprop(Network *net, Network *grad, const Data *data);   // returns the batch's mean loss, -1 on bad args
+float backprop_view(Network *net, Network *grad, const Tensor *in, const Tensor *out);
+float backprop_labels(Network *net, Network *grad, const Tensor *in, const uint16_t *labels);   // class ids, see below
 void apply_grad(Network *net, const Network *grad, float rate);
 
+Optimizer *optimizer_alloc(size_t n, int type, float lr);   // n parameters, e.g. from network_params
+void optimizer_free(Optimizer *o);
+void optimizer_set_lr(Optimizer *o, float lr);
+void optimizer_set_hparams(Optimizer *o, float beta1, float beta2, float eps, float decay);
+void optimizer_set_clip(Optimizer *o, float max_norm, float max_value);   // global L2 / per value, 0 = off
+void optimizer_step(Optimizer *o, Network *net, const Network *grad);   // apply_grad with moments
+void optimizer_update(Optimizer *o, float *w, const float *g);          // same on raw arrays of n
+
 int network_save(const Network *net, const char *path);
 Network *network_load(const char *path, const size_t *arch, size_t n, const int *act, int loss);
 
-Matrix *matrix_from_csv(const char *path, size_t rows, size_t cols);
+Matrix *matrix_load_csv(const char *path, size_t *err_line);   // shape inferred; see CSV below
+Matrix *matrix_from_csv(const char *path, size_t rows, size_t cols);   // first rows x cols, 0 = all
+int data_load_csv(Data *d, const char *path, const CsvColumn *spec, size_t nspec, size_t *err_line);
+void data_free(Data *d);   // what data_load_csv allocated
+int dataset_save(const Data *data, const char *path);
+int dataset_from_csv(const char *csv, const char *path, long label_col, float scale, size_t *err_line);
+Dataset *dataset_open(const char *path);   // mmap'd, no parsing; NULL on a bad or foreign file
+const Data *dataset_data(const Dataset *ds);   // views into the mapping, writes stay private
+const DatasetHeader *dataset_header(const Dataset *ds);
+void dataset_close(Dataset *ds);
+DataStream *stream_open(const char *const *paths, size_t n, size_t batch, size_t window, uint64_t seed);   // see Streaming
+int stream_next(DataStream *s, Data *batch);   // 1 = a batch, 0 = end of an epoch, -1 = error
+const DatasetHeader *stream_header(const DataStream *s);   // rows of all shards
+void stream_close(DataStream *s);
+IdxFile *idx_open(const char *path);   // unsigned-byte IDX only, NULL otherwise or when short
+Tensor idx_tensor(const IdxFile *f, float scale);   // items x rest of the dims, u8 in the mapping
+uint16_t *idx_labels(const IdxFile *f);   // the bytes as class ids, malloc'd
+void idx_close(IdxFile *f);
 float network_mse(const Network *net, const Data *data);
-void network_predict(const Network *net, const float *input, float *output);
+float network_mse_view(const Network *net, const Tensor *in, const Tensor *out);
+float network_loss(const Network *net, const Data *data);   // the net's own loss (MSE or CE), mean per row
+float network_loss_view(const Network *net, const Tensor *in, const Tensor *out);
+float network_loss_labels(const Network *net, const Tensor *in, const uint16_t *labels);
+float network_accuracy(const Network *net, const Tensor *in, const uint16_t *labels);   // fraction argmax == label
+void network_predict(const Network *net, const float *input, float *output);   // reentrant
+int network_predict_batch(const Network *net, const float *input, size_t n, float *output);   // n rows in, n rows out; -1 on failure
+
+InferenceSession *session_alloc(const Network *net, size_t rows);   // net borrowed read-only; rows grow on demand
+void session_free(InferenceSession *s);
+const Matrix *session_forward(InferenceSession *s, const Tensor *x);   // valid until the next call
+void session_predict(InferenceSession *s, const float *input, float *output);
+
+QNetwork *network_quantize(const Network *net, const Data *calib);   // calib->out unused
+void qnetwork_free(QNetwork *q);
+int network_predict_q8(const QNetwork *q, const float *input, float *output);   // reentrant; -1: bad args or no memory
 
 #endif /* XNN_H_ */
 
@@ -72,382 +211,3547 @@ void network_predict(const Network *net, const float *input, float *output);
  * IMPLEMENTATION
  * ============================================================== */
 #ifdef XNN_IMPLEMENTATION
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+typedef struct XnnSparse XnnSparse;
 
 struct Network {
     size_t layers;
     Matrix **w, **b, **a;
+    float *params;     // every w and b in one 64-byte aligned block, [w0 b0 w1 b1 ...]
+    size_t nparams;
+    Matrix *views;     // the w/b headers, data pointing into params
     int *activations;
     int loss;
+    int fast;          // polynomial exp/tanh/sigmoid instead of libm
+    int prec;          // PREC_*: GEMMs read wh, w stays the fp32 master
+    uint16_t **wh;     // bf16/fp16 copies of w, refreshed by apply_grad
+    XnnSparse **sp;    // network_prune: sparse copy of w per layer (NULL = dense); apply_grad drops it
+    float **ab;        // forward_batch: ab[l] is ab_cap x arch[l] (ab[0]: gathered input rows)
+    float **dm;        // backprop: f'(z) per ab element, or a ReLU bitmask (see XnnEpilogue)
+    size_t ab_cap;
+    Matrix out;        // forward_view's result, a header over the last ab
+    float *shards;     // backprop: per-thread gradients for shards 1..T-1, then per-chunk |g|^2
+    size_t shard_cap;
+    float grad_sq;     // backprop: |grad|^2 of the gradient it wrote, < 0 = unknown
 };
 
-/* ---------- Matrix ---------- */
-Matrix *matrix_alloc(size_t r, size_t c)
+/* ---------- SIMD dispatch ----------
+ * One binary, every x86 box: each hot loop has a scalar, SSE2, AVX2+FMA
+ * and AVX-512F variant compiled with per-function target attributes, and
+ * xnn_set_isa() points the kernel table at the best one cpuid (via
+ * __builtin_cpu_supports, which also checks OS xsave state) reports.
+ * XNN_ISA=scalar|sse2|avx2|avx512 in the environment caps the choice. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(XNN_NO_SIMD)
+#define XNN_X86 1
+#include <immintrin.h>
+#define XNN_TARGET(t) __attribute__((target(t)))
+#endif
+
+/* One optimizer step, folded to per-element constants (see Optimizers):
+ *   g' = clamp(gs*g, +-clip) + l2*w;  m = b1*m + a1*g';  v = b2*v + a2*g'^2
+ *   w  = keep*w - lr*u,  u = (m or g') / (sqrt(v)*vs + eps), or without v */
+typedef struct { float lr, keep, l2, b1, a1, b2, a2, vs, eps, gs, clip; } XnnOptStep;
+
+typedef struct {
+    int isa;
+    size_t mr, nr;
+    void (*gemm_kernel)(size_t kc, const float *a, const float *b, float *c, size_t ldc, float alpha, float beta);
+    float (*dot)(const float *a, const float *b, size_t n);
+    float (*sumsq)(const float *x, size_t n);
+    void (*add)(float *y, const float *x, size_t n);
+    void (*axpy)(float *y, float a, const float *x, size_t n);
+    void (*scale)(float *x, float s, size_t n);
+    void (*fill)(float *x, float v, size_t n);
+    void (*relu)(float *x, size_t n);
+    void (*sigmoid)(float *x, size_t n);      // fast-math variants
+    void (*tanh)(float *x, size_t n);
+    float (*expsum)(float *x, float shift, size_t n);   // x = e^(x-shift), returns sum
+    void (*h2f[2])(float *y, const uint16_t *x, size_t n);   // [prec-1]: bf16, fp16 -> fp32
+    void (*f2h[2])(uint16_t *y, const float *x, size_t n);   // fp32 -> bf16, fp16 (nearest even)
+    int32_t (*dot_q8)(const uint8_t *a, const int8_t *w, size_t n);   // n % 64 == 0
+    void (*spmv[3])(float *y, const uint32_t *ptr, const uint32_t *col, const float *val,
+                    size_t nb, const float *x);   // [0] CSR, [1] 4x1, [2] 8x1 blocks; see XnnSparse
+    void (*opt)(const XnnOptStep *s, float *w, float *m, float *v, const float *g, size_t n);   // m, v may be NULL
+    void (*u8f)(float *y, const uint8_t *x, float s, size_t n);   // y = x*s
+} XnnKernels;
+
+/* scalar */
+#define XNN_MR_MAX 8
+#define XNN_NR_MAX 32
+static void gemm_kernel_scalar(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                               float alpha, float beta)
 {
-    if (!r || !c) return NULL;
-    Matrix *m = malloc(sizeof*m);
-    if (!m) return NULL;
-    m->rows = r; m->cols = c;
-    m->data = malloc(r*c*sizeof(float));
-    if (!m->data) { free(m); return NULL; }
-    return m;
+    float acc[4][8] = {{0}};
+    for (size_t k = 0; k < kc; ++k, a += 4, b += 8)
+        for (size_t i = 0; i < 4; ++i)
+            for (size_t j = 0; j < 8; ++j)
+                acc[i][j] += a[i] * b[j];
+    for (size_t i = 0; i < 4; ++i)
+        for (size_t j = 0; j < 8; ++j)
+            c[i*ldc+j] = alpha*acc[i][j] + (beta == 0.0f ? 0.0f : beta*c[i*ldc+j]);
+}
+static float dot_scalar(const float *a, const float *b, size_t n)
+{
+    float s[8] = {0};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        for (size_t j = 0; j < 8; ++j) s[j] += a[i+j]*b[i+j];
+    for (; i < n; ++i) s[0] += a[i]*b[i];
+    return ((s[0]+s[4])+(s[1]+s[5])) + ((s[2]+s[6])+(s[3]+s[7]));
 }
-void matrix_free(Matrix *m){ if(m){free(m->data);free(m);} }
+static float sumsq_scalar(const float *x, size_t n) { return dot_scalar(x, x, n); }
+static void add_scalar(float *y, const float *x, size_t n) { for (size_t i = 0; i < n; ++i) y[i] += x[i]; }
+static void axpy_scalar(float *y, float a, const float *x, size_t n) { for (size_t i = 0; i < n; ++i) y[i] += a*x[i]; }
+static void scale_scalar(float *x, float s, size_t n) { for (size_t i = 0; i < n; ++i) x[i] *= s; }
+static void fill_scalar(float *x, float v, size_t n) { for (size_t i = 0; i < n; ++i) x[i] = v; }
+static void relu_scalar(float *x, size_t n) { for (size_t i = 0; i < n; ++i) if (x[i] < 0) x[i] = 0; }
 
-int matrix_copy(Matrix *dst, const Matrix *src)
+/* Fast exp/sigmoid/tanh (network_set_fast_math). exp is Cephes-style:
+ * x = n*ln2 + r, |r| <= ln2/2, degree-6 polynomial for e^r, 2^n built in
+ * the exponent bits. Inputs are clamped to [-87.33, 88.37], so results
+ * never go denormal or inf. tanh uses an odd polynomial for |x| < 0.625
+ * and 1 - 2/(e^2|x| + 1) above. Measured worst case vs. libm (test.c):
+ *   exp      relative error < 2e-7  (~2 ulp)
+ *   sigmoid  absolute error < 2e-7
+ *   tanh     absolute error < 2e-7, relative error < 4e-7 */
+#define XNN_EXP_LO  -87.33654f
+#define XNN_EXP_HI   88.37626f
+#define XNN_LOG2E    1.44269504088896341f
+#define XNN_LN2_HI   0.693359375f
+#define XNN_LN2_LO  -2.12194440e-4f
+#define XNN_EXP_P0   1.9875691500e-4f
+#define XNN_EXP_P1   1.3981999507e-3f
+#define XNN_EXP_P2   8.3334519073e-3f
+#define XNN_EXP_P3   4.1665795894e-2f
+#define XNN_EXP_P4   1.6666665459e-1f
+#define XNN_EXP_P5   5.0000001201e-1f
+#define XNN_TANH_P0 -5.70498872745e-3f
+#define XNN_TANH_P1  2.06390887954e-2f
+#define XNN_TANH_P2 -5.37397155531e-2f
+#define XNN_TANH_P3  1.33314422036e-1f
+#define XNN_TANH_P4 -3.33332819422e-1f
+
+static float xnn_expf(float x)
 {
-    if (!dst || !src || dst->rows != src->rows || dst->cols != src->cols) return -1;
-    memcpy(dst->data, src->data, src->rows * src->cols * sizeof(float));
-    return 0;
+    x = x < XNN_EXP_LO ? XNN_EXP_LO : x > XNN_EXP_HI ? XNN_EXP_HI : x;
+    float n = floorf(x * XNN_LOG2E + 0.5f);
+    float r = x - n*XNN_LN2_HI - n*XNN_LN2_LO;
+    float p = XNN_EXP_P0;
+    p = p*r + XNN_EXP_P1; p = p*r + XNN_EXP_P2; p = p*r + XNN_EXP_P3;
+    p = p*r + XNN_EXP_P4; p = p*r + XNN_EXP_P5;
+    p = p*r*r + r + 1.0f;
+    int32_t e = ((int32_t)n + 127) << 23;
+    float scale;
+    memcpy(&scale, &e, sizeof scale);
+    return p * scale;
 }
-float rand_float(float lo, float hi)
-{ return lo + (float)rand()/RAND_MAX * (hi-lo); }
-void matrix_rand(Matrix *m, float lo, float hi)
-{ for(size_t i=0;i<m->rows*m->cols;i++) m->data[i]=rand_float(lo,hi); }
-void matrix_rand_bias(Matrix *m){ matrix_rand(m,-0.1f,0.1f); }
-void matrix_fill(Matrix *m, float v)
-{ for(size_t i=0;i<m->rows*m->cols;i++) m->data[i]=v; }
-void matrix_print(const Matrix *m)
+static float xnn_tanhf(float x)
 {
-    for(size_t i=0;i<m->rows;i++){
-        for(size_t j=0;j<m->cols;j++) printf("%.5f ",m->data[i*m->cols+j]);
-        printf("\n");
+    float ax = fabsf(x);
+    if (ax < 0.625f) {
+        float z = x*x, p = XNN_TANH_P0;
+        p = p*z + XNN_TANH_P1; p = p*z + XNN_TANH_P2; p = p*z + XNN_TANH_P3; p = p*z + XNN_TANH_P4;
+        return p*z*x + x;
     }
+    float t = 1.0f - 2.0f / (xnn_expf(2.0f*ax) + 1.0f);
+    return x < 0 ? -t : t;
 }
-float matrix_norm(const Matrix *m)
+static void sigmoid_scalar(float *x, size_t n) { for (size_t i = 0; i < n; ++i) x[i] = 1.0f / (1.0f + xnn_expf(-x[i])); }
+static void tanh_scalar(float *x, size_t n) { for (size_t i = 0; i < n; ++i) x[i] = xnn_tanhf(x[i]); }
+static float expsum_scalar(float *x, float shift, size_t n)
 {
-    if (!m) return 0.0f;
-    float sum = 0.0f;
-    for (size_t i = 0; i < m->rows * m->cols; ++i)
-        sum += m->data[i] * m->data[i];
-    return sqrtf(sum);
+    float s = 0.0f;
+    for (size_t i = 0; i < n; ++i) { x[i] = xnn_expf(x[i] - shift); s += x[i]; }
+    return s;
 }
-int matrix_sum(Matrix *dst, const Matrix *src)
+
+/* Half-precision storage. bf16 is the top half of an fp32; fp16 is
+ * rebiased, with subnormals, and rounds to nearest even both ways. */
+static float bf16_f32(uint16_t h)
 {
-    if(!dst||!src||dst->rows!=src->rows||dst->cols!=src->cols) return -1;
-    for(size_t i=0;i<dst->rows*dst->cols;i++) dst->data[i]+=src->data[i];
-    return 0;
+    uint32_t u = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &u, 4);
+    return f;
 }
-int matrix_dot(Matrix *dst, const Matrix *a, const Matrix *b)
+static uint16_t f32_bf16(float f)
 {
-    if(!dst||!a||!b||a->cols!=b->rows||dst->rows!=a->rows||dst->cols!=b->cols) return -1;
-    matrix_fill(dst,0);
-    for(size_t i=0;i<a->rows;i++)
-        for(size_t j=0;j<b->cols;j++)
-            for(size_t k=0;k<a->cols;k++)
-                dst->data[i*dst->cols+j] +=
-                    a->data[i*a->cols+k] * b->data[k*b->cols+j];
-    return 0;
+    uint32_t u;
+    memcpy(&u, &f, 4);
+    if ((u & 0x7fffffff) > 0x7f800000) return (uint16_t)(u >> 16 | 0x40);   // quiet NaN
+    return (uint16_t)((u + 0x7fff + (u >> 16 & 1)) >> 16);
+}
+static float fp16_f32(uint16_t h)
+{
+    uint32_t s = (uint32_t)(h & 0x8000) << 16, e = h >> 10 & 0x1f, m = h & 0x3ff, u;
+    if (!e) { float f = m * 5.9604644775390625e-8f; return s ? -f : f; }   // m * 2^-24
+    u = e == 0x1f ? s | 0x7f800000 | m << 13 : s | (e + 112) << 23 | m << 13;
+    float f;
+    memcpy(&f, &u, 4);
+    return f;
+}
+static uint16_t f32_fp16(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, 4);
+    uint16_t s = (uint16_t)(u >> 16 & 0x8000);
+    u &= 0x7fffffff;
+    if (u > 0x7f800000) return s | 0x7e00;
+    if (u >= 0x477ff000) return s | 0x7c00;                      // rounds past 65504
+    if (u < 0x38800000) { memcpy(&f, &u, 4); return s | (uint16_t)lrintf(f * 16777216.0f); }
+    return s | (uint16_t)((u + 0xfff + (u >> 13 & 1) - 0x38000000) >> 13);
+}
+static void bf16_f32_scalar(float *y, const uint16_t *x, size_t n) { for (size_t i = 0; i < n; ++i) y[i] = bf16_f32(x[i]); }
+static void fp16_f32_scalar(float *y, const uint16_t *x, size_t n) { for (size_t i = 0; i < n; ++i) y[i] = fp16_f32(x[i]); }
+static void f32_bf16_scalar(uint16_t *y, const float *x, size_t n) { for (size_t i = 0; i < n; ++i) y[i] = f32_bf16(x[i]); }
+static void f32_fp16_scalar(uint16_t *y, const float *x, size_t n) { for (size_t i = 0; i < n; ++i) y[i] = f32_fp16(x[i]); }
+static int32_t dot_q8_scalar(const uint8_t *a, const int8_t *w, size_t n)
+{
+    int32_t s = 0;
+    for (size_t i = 0; i < n; ++i) s += (int32_t)a[i] * w[i];
+    return s;
+}
+static void spmv_csr_scalar(float *y, const uint32_t *ptr, const uint32_t *col, const float *val,
+                            size_t nb, const float *x)
+{
+    for (size_t r = 0; r < nb; ++r) {
+        float s[4] = {0};
+        uint32_t k = ptr[r];
+        for (; k + 4 <= ptr[r+1]; k += 4)
+            for (int i = 0; i < 4; ++i) s[i] += val[k+i] * x[col[k+i]];
+        for (; k < ptr[r+1]; ++k) s[0] += val[k] * x[col[k]];
+        y[r] = (s[0] + s[1]) + (s[2] + s[3]);
+    }
+}
+static void spmv_b4_scalar(float *y, const uint32_t *ptr, const uint32_t *col, const float *val,
+                           size_t nb, const float *x)
+{
+    for (size_t r = 0; r < nb; ++r) {
+        float s[4] = {0};
+        for (uint32_t k = ptr[r]; k < ptr[r+1]; ++k)
+            for (int i = 0; i < 4; ++i) s[i] += val[4*k+i] * x[col[k]];
+        memcpy(y + 4*r, s, sizeof(s));
+    }
+}
+static void spmv_b8_scalar(float *y, const uint32_t *ptr, const uint32_t *col, const float *val,
+                           size_t nb, const float *x)
+{
+    for (size_t r = 0; r < nb; ++r) {
+        float s[8] = {0};
+        for (uint32_t k = ptr[r]; k < ptr[r+1]; ++k)
+            for (int i = 0; i < 8; ++i) s[i] += val[8*k+i] * x[col[k]];
+        memcpy(y + 8*r, s, sizeof(s));
+    }
 }
 
-/* ---------- Activations ---------- */
-static void act_sigmoid(Matrix *m)
-{ for(size_t i=0;i<m->rows*m->cols;i++) m->data[i]=1/(1+expf(-m->data[i])); }
-static float dact_sigmoid(float x)
-{ float s=1/(1+expf(-x)); return s*(1-s); }
-static void act_tanh(Matrix *m)
-{ for(size_t i=0;i<m->rows*m->cols;i++) m->data[i]=tanhf(m->data[i]); }
-static float dact_tanh(float x)
-{ float t=tanhf(x); return 1-t*t; }
-static void act_relu(Matrix *m)
-{ for(size_t i=0;i<m->rows*m->cols;i++) if(m->data[i]<0) m->data[i]=0; }
-static float dact_relu(float x) { return x>0?1:0; }
-static void act_softmax(Matrix *m)
+static void opt_scalar(const XnnOptStep *s, float *w, float *m, float *v, const float *g, size_t n)
 {
-    if (!m || m->cols != 1) return;
-    float max = m->data[0];
-    for (size_t i = 1; i < m->rows; ++i)
-        if (m->data[i] > max) max = m->data[i];
-    float sum = 0.0f;
-    for (size_t i = 0; i < m->rows; ++i) {
-        m->data[i] = expf(m->data[i] - max);
-        sum += m->data[i];
+    for (size_t i = 0; i < n; ++i) {
+        float gi = s->gs*g[i];
+        gi = (gi > s->clip ? s->clip : gi < -s->clip ? -s->clip : gi) + s->l2*w[i];
+        float u = gi;
+        if (m) u = m[i] = s->b1*m[i] + s->a1*gi;
+        if (v) { v[i] = s->b2*v[i] + s->a2*gi*gi; u /= sqrtf(v[i])*s->vs + s->eps; }
+        w[i] = s->keep*w[i] - s->lr*u;
     }
-    for (size_t i = 0; i < m->rows; ++i) m->data[i] /= sum;
 }
-static void act_linear(Matrix *m) { /* identity */ }
-static float dact_linear(float x) { return 1.0f; }
+static void u8f_scalar(float *y, const uint8_t *x, float s, size_t n) { for (size_t i = 0; i < n; ++i) y[i] = x[i]*s; }
 
-/* ---------- Network ---------- */
-Network *network_alloc(const size_t *arch, size_t n, const int *act, int loss)
+/* isa < 0 until the first kernel lookup runs detection */
+static XnnKernels xnn_k = { -1, 4, 8, gemm_kernel_scalar, dot_scalar, sumsq_scalar,
+                            add_scalar, axpy_scalar, scale_scalar, fill_scalar, relu_scalar,
+                            sigmoid_scalar, tanh_scalar, expsum_scalar,
+                            {bf16_f32_scalar, fp16_f32_scalar}, {f32_bf16_scalar, f32_fp16_scalar},
+                            dot_q8_scalar, {spmv_csr_scalar, spmv_b4_scalar, spmv_b8_scalar}, opt_scalar, u8f_scalar };
+
+#ifdef XNN_X86
+/* g++ 12 flags _mm512_undefined_ps() inside the intrinsic headers */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+/* SSE2: 4x8 tile, 8 xmm accumulators */
+XNN_TARGET("sse2")
+static void gemm_kernel_sse2(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                             float alpha, float beta)
 {
-    if(!arch||n<2||!act) return NULL;
-    Network *net = malloc(sizeof*net);
-    if(!net) return NULL;
-    net->layers = n;
-    net->loss = loss;
-    net->activations = malloc(sizeof(int)*n);
-    if(!net->activations) { free(net); return NULL; }
-    memcpy(net->activations, act, sizeof(int)*n);
-    net->w = malloc(sizeof(Matrix*)*(n-1));
-    net->b = malloc(sizeof(Matrix*)*(n-1));
-    net->a = malloc(sizeof(Matrix*)*n);
-    if(!net->w||!net->b||!net->a) goto fail;
-    net->a[0] = matrix_alloc(arch[0],1);
-    if(!net->a[0]) goto fail;
-    for(size_t i=1;i<n;i++){
-        net->w[i-1]=matrix_alloc(arch[i],arch[i-1]);
-        net->b[i-1]=matrix_alloc(arch[i],1);
-        net->a[i] =matrix_alloc(arch[i],1);
-        if(!net->w[i-1]||!net->b[i-1]||!net->a[i]) goto fail;
+    __m128 c0l = _mm_setzero_ps(), c0h = _mm_setzero_ps(), c1l = _mm_setzero_ps(), c1h = _mm_setzero_ps();
+    __m128 c2l = _mm_setzero_ps(), c2h = _mm_setzero_ps(), c3l = _mm_setzero_ps(), c3h = _mm_setzero_ps();
+    for (size_t k = 0; k < kc; ++k, a += 4, b += 8) {
+        __m128 bl = _mm_loadu_ps(b), bh = _mm_loadu_ps(b + 4), x;
+        x = _mm_set1_ps(a[0]); c0l = _mm_add_ps(c0l, _mm_mul_ps(x, bl)); c0h = _mm_add_ps(c0h, _mm_mul_ps(x, bh));
+        x = _mm_set1_ps(a[1]); c1l = _mm_add_ps(c1l, _mm_mul_ps(x, bl)); c1h = _mm_add_ps(c1h, _mm_mul_ps(x, bh));
+        x = _mm_set1_ps(a[2]); c2l = _mm_add_ps(c2l, _mm_mul_ps(x, bl)); c2h = _mm_add_ps(c2h, _mm_mul_ps(x, bh));
+        x = _mm_set1_ps(a[3]); c3l = _mm_add_ps(c3l, _mm_mul_ps(x, bl)); c3h = _mm_add_ps(c3h, _mm_mul_ps(x, bh));
     }
-    network_rand(net);
-    return net;
-fail:
-    network_free(net);
-    return NULL;
+    __m128 acc[8] = {c0l, c0h, c1l, c1h, c2l, c2h, c3l, c3h};
+    __m128 va = _mm_set1_ps(alpha), vb = _mm_set1_ps(beta);
+    for (int i = 0; i < 4; ++i)
+        for (int h = 0; h < 2; ++h) {
+            float *p = c + i*ldc + h*4;
+            __m128 r = _mm_mul_ps(va, acc[i*2+h]);
+            if (beta != 0.0f) r = _mm_add_ps(r, _mm_mul_ps(vb, _mm_loadu_ps(p)));
+            _mm_storeu_ps(p, r);
+        }
 }
-void network_free(Network *net)
+XNN_TARGET("sse2")
+static float hsum_sse2(__m128 v)
 {
-    if(!net) return;
-    if(net->activations) free(net->activations);
-    if(net->a){ for(size_t i=0;i<net->layers;i++) matrix_free(net->a[i]); free(net->a); }
-    if(net->w){ for(size_t i=0;i<net->layers-1;i++) matrix_free(net->w[i]); free(net->w); }
-    if(net->b){ for(size_t i=0;i<net->layers-1;i++) matrix_free(net->b[i]); free(net->b); }
-    free(net);
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
 }
-void network_rand(Network *net)
+XNN_TARGET("sse2")
+static float dot_sse2(const float *a, const float *b, size_t n)
 {
-    if(!net) return;
-    for(size_t i=0;i<net->layers-1;i++){
-        Matrix *w = net->w[i];
-        size_t fan_in = w->cols, fan_out = w->rows;
-        float limit;
-        int act_type = net->activations[i+1];
-        if (act_type == ACT_RELU || act_type == ACT_LINEAR) {
-            limit = sqrtf(2.0f / fan_in);
-        } else {
-            limit = sqrtf(6.0f / (fan_in + fan_out));
-        }
-        for(size_t j=0;j<w->rows*w->cols;j++)
-            w->data[j] = rand_float(-limit, limit);
-        if(net->b[i]) matrix_rand_bias(net->b[i]);
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a+i),   _mm_loadu_ps(b+i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4)));
     }
+    float s = hsum_sse2(_mm_add_ps(s0, s1));
+    for (; i < n; ++i) s += a[i]*b[i];
+    return s;
 }
-void network_zero(Network *net)
+XNN_TARGET("sse2") static float sumsq_sse2(const float *x, size_t n) { return dot_sse2(x, x, n); }
+XNN_TARGET("sse2")
+static void add_sse2(float *y, const float *x, size_t n)
 {
-    if(!net) return;
-    for(size_t i=0;i<net->layers-1;i++){
-        matrix_fill(net->w[i],0);
-        matrix_fill(net->b[i],0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(y+i, _mm_add_ps(_mm_loadu_ps(y+i), _mm_loadu_ps(x+i)));
+    for (; i < n; ++i) y[i] += x[i];
+}
+XNN_TARGET("sse2")
+static void axpy_sse2(float *y, float a, const float *x, size_t n)
+{
+    __m128 va = _mm_set1_ps(a);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(y+i, _mm_add_ps(_mm_loadu_ps(y+i), _mm_mul_ps(va, _mm_loadu_ps(x+i))));
+    for (; i < n; ++i) y[i] += a*x[i];
+}
+XNN_TARGET("sse2")
+static void scale_sse2(float *x, float s, size_t n)
+{
+    __m128 vs = _mm_set1_ps(s);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(x+i, _mm_mul_ps(_mm_loadu_ps(x+i), vs));
+    for (; i < n; ++i) x[i] *= s;
+}
+XNN_TARGET("sse2")
+static void fill_sse2(float *x, float v, size_t n)
+{
+    __m128 vv = _mm_set1_ps(v);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(x+i, vv);
+    for (; i < n; ++i) x[i] = v;
+}
+XNN_TARGET("sse2")
+static void relu_sse2(float *x, size_t n)
+{
+    __m128 z = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(x+i, _mm_max_ps(_mm_loadu_ps(x+i), z));
+    for (; i < n; ++i) if (x[i] < 0) x[i] = 0;
+}
+XNN_TARGET("sse2")
+static __m128 exp_sse2(__m128 x)
+{
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(XNN_EXP_LO)), _mm_set1_ps(XNN_EXP_HI));
+    __m128i ni = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(XNN_LOG2E)));
+    __m128 n = _mm_cvtepi32_ps(ni);
+    __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(XNN_LN2_HI))), _mm_mul_ps(n, _mm_set1_ps(XNN_LN2_LO)));
+    __m128 p = _mm_set1_ps(XNN_EXP_P0);
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(XNN_EXP_P1));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(XNN_EXP_P2));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(XNN_EXP_P3));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(XNN_EXP_P4));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(XNN_EXP_P5));
+    p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, r), r), r), _mm_set1_ps(1.0f));
+    return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(ni, _mm_set1_epi32(127)), 23)));
+}
+XNN_TARGET("sse2")
+static __m128 tanh_sse2(__m128 x)
+{
+    __m128 sign = _mm_and_ps(x, _mm_set1_ps(-0.0f)), ax = _mm_xor_ps(x, sign);
+    __m128 z = _mm_mul_ps(x, x), p = _mm_set1_ps(XNN_TANH_P0);
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(XNN_TANH_P1));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(XNN_TANH_P2));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(XNN_TANH_P3));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(XNN_TANH_P4));
+    __m128 small = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), x), x);
+    __m128 e = exp_sse2(_mm_add_ps(ax, ax));
+    __m128 big = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_div_ps(_mm_set1_ps(2.0f), _mm_add_ps(e, _mm_set1_ps(1.0f))));
+    big = _mm_or_ps(big, sign);
+    __m128 m = _mm_cmplt_ps(ax, _mm_set1_ps(0.625f));
+    return _mm_or_ps(_mm_and_ps(m, small), _mm_andnot_ps(m, big));
+}
+XNN_TARGET("sse2")
+static void sigmoid_sse2(float *x, size_t n)
+{
+    __m128 one = _mm_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(x+i, _mm_div_ps(one, _mm_add_ps(one, exp_sse2(_mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(x+i))))));
+    sigmoid_scalar(x+i, n-i);
+}
+XNN_TARGET("sse2")
+static void tanh_sse2_n(float *x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(x+i, tanh_sse2(_mm_loadu_ps(x+i)));
+    tanh_scalar(x+i, n-i);
+}
+XNN_TARGET("sse2")
+static float expsum_sse2(float *x, float shift, size_t n)
+{
+    __m128 vs = _mm_set1_ps(shift), acc = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 e = exp_sse2(_mm_sub_ps(_mm_loadu_ps(x+i), vs));
+        _mm_storeu_ps(x+i, e);
+        acc = _mm_add_ps(acc, e);
     }
+    return hsum_sse2(acc) + expsum_scalar(x+i, shift, n-i);
 }
-void network_print(const Network *net)
+XNN_TARGET("sse2")
+static void bf16_f32_sse2(float *y, const uint16_t *x, size_t n)
 {
-    if (!net) return;
-    printf("Network: %zu layers, loss=%s\n", net->layers,
-           net->loss == LOSS_MSE ? "MSE" : "Cross-Entropy");
-    for (size_t i = 0; i < net->layers - 1; ++i) {
-        const char* act_str = 
-            net->activations[i+1] == ACT_SIGMOID ? "Sigmoid" :
-            net->activations[i+1] == ACT_TANH ? "Tanh" :
-            net->activations[i+1] == ACT_RELU ? "ReLU" :
-            net->activations[i+1] == ACT_SOFTMAX ? "Softmax" :
-            net->activations[i+1] == ACT_LINEAR ? "Linear" : "Unknown";
-        printf("Layer %zu -> %zu: %s\n", i, i+1, act_str);
-        printf(" W: "); matrix_print(net->w[i]);
-        printf(" b: "); matrix_print(net->b[i]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(x+i)), z = _mm_setzero_si128();
+        _mm_storeu_si128((__m128i*)(y+i), _mm_unpacklo_epi16(z, v));
+        _mm_storeu_si128((__m128i*)(y+i+4), _mm_unpackhi_epi16(z, v));
     }
+    bf16_f32_scalar(y+i, x+i, n-i);
 }
-void forward(Network *net)
+XNN_TARGET("sse2")
+static int32_t dot_q8_sse2(const uint8_t *a, const int8_t *w, size_t n)
 {
-    if(!net) return;
-    for(size_t i=0;i<net->layers-1;i++){
-        matrix_dot(net->a[i+1], net->w[i], net->a[i]);
-        matrix_sum(net->a[i+1], net->b[i]);
-        int act = net->activations[i+1];
-        if(act == ACT_SIGMOID) act_sigmoid(net->a[i+1]);
-        else if(act == ACT_TANH) act_tanh(net->a[i+1]);
-        else if(act == ACT_RELU) act_relu(net->a[i+1]);
-        else if(act == ACT_SOFTMAX) act_softmax(net->a[i+1]);
-        else if(act == ACT_LINEAR) act_linear(net->a[i+1]);
-    }
-}
-void backprop(Network *net, Network *grad, const Data *data)
-{
-    if(!net||!grad||!data||!data->in||!data->out) return;
-    size_t batch = data->in->rows;
-    size_t in_sz = data->in->cols;
-    size_t out_sz= data->out->cols;
-    size_t L = net->layers-1;
-    if(in_sz!=net->a[0]->rows || out_sz!=net->a[L]->rows || batch!=data->out->rows) return;
-
-    network_zero(grad);
-
-    for(size_t s=0;s<batch;s++){
-        for(size_t l=1;l<net->layers;l++) matrix_fill(grad->a[l], 0);
-
-        memcpy(net->a[0]->data, &data->in->data[s*in_sz], in_sz*sizeof(float));
-        forward(net);
-
-        for(size_t j=0;j<out_sz;j++){
-            float p = net->a[L]->data[j];
-            float t = data->out->data[s*out_sz+j];
-            if (net->loss == LOSS_MSE) {
-                grad->a[L]->data[j] = 2*(p-t);
-            } else {
-                grad->a[L]->data[j] = p - t;
-            }
-        }
-
-        for(size_t l=L;l>0;--l){
-            for(size_t j=0;j<net->a[l]->rows;j++){
-                float a  = net->a[l]->data[j];
-                float da = grad->a[l]->data[j];
-                int act  = net->activations[l];
-                float ds;
-                if (l == L && net->loss == LOSS_CE && act == ACT_SOFTMAX) {
-                    ds = 1.0f;
-                } else {
-                    ds = (act == ACT_SIGMOID) ? dact_sigmoid(a) :
-                         (act == ACT_TANH)    ? dact_tanh(a)    :
-                         (act == ACT_RELU)    ? dact_relu(a)    :
-                         (act == ACT_LINEAR)  ? dact_linear(a)  : 0;
-                }
-                grad->b[l-1]->data[j] += da * ds;
-                for(size_t k=0;k<net->a[l-1]->rows;k++){
-                    float prev = net->a[l-1]->data[k];
-                    float w    = net->w[l-1]->data[j*net->w[l-1]->cols + k];
-                    grad->w[l-1]->data[j*net->w[l-1]->cols + k] += da * ds * prev;
-                    if(l>1) grad->a[l-1]->data[k] += da * ds * w;
-                }
-            }
+    __m128i acc = _mm_setzero_si128(), z = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a+i)), vw = _mm_loadu_si128((const __m128i*)(w+i));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(va, z), _mm_srai_epi16(_mm_unpacklo_epi8(vw, vw), 8)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(va, z), _mm_srai_epi16(_mm_unpackhi_epi8(vw, vw), 8)));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+    return _mm_cvtsi128_si32(acc);
+}
+XNN_TARGET("sse2")
+static void spmv_b4_sse2(float *y, const uint32_t *ptr, const uint32_t *col, const float *val,
+                         size_t nb, const float *x)
+{
+    for (size_t r = 0; r < nb; ++r) {
+        __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+        uint32_t k = ptr[r];
+        for (; k + 2 <= ptr[r+1]; k += 2) {
+            s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(val + 4*k), _mm_set1_ps(x[col[k]])));
+            s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(val + 4*k+4), _mm_set1_ps(x[col[k+1]])));
         }
+        if (k < ptr[r+1]) s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(val + 4*k), _mm_set1_ps(x[col[k]])));
+        _mm_storeu_ps(y + 4*r, _mm_add_ps(s0, s1));
     }
+}
 
-    for(size_t i=0;i<grad->layers-1;i++){
-        size_t n = grad->w[i]->rows*grad->w[i]->cols;
-        for(size_t j=0;j<n;j++) grad->w[i]->data[j] /= (float)batch;
-        n = grad->b[i]->rows;
-        for(size_t j=0;j<n;j++) grad->b[i]->data[j] /= (float)batch;
+/* AVX2 + FMA: 6x16 tile, 12 ymm accumulators */
+XNN_TARGET("avx2,fma")
+static void gemm_kernel_avx2(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                             float alpha, float beta)
+{
+    __m256 acc[6][2];
+    for (int i = 0; i < 6; ++i) acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+    for (size_t k = 0; k < kc; ++k, a += 6, b += 16) {
+        __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b + 8);
+        for (int i = 0; i < 6; ++i) {
+            __m256 x = _mm256_broadcast_ss(a + i);
+            acc[i][0] = _mm256_fmadd_ps(x, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(x, b1, acc[i][1]);
+        }
     }
+    __m256 va = _mm256_set1_ps(alpha), vb = _mm256_set1_ps(beta);
+    for (int i = 0; i < 6; ++i)
+        for (int h = 0; h < 2; ++h) {
+            float *p = c + i*ldc + h*8;
+            __m256 r = _mm256_mul_ps(va, acc[i][h]);
+            if (beta != 0.0f) r = _mm256_fmadd_ps(vb, _mm256_loadu_ps(p), r);
+            _mm256_storeu_ps(p, r);
+        }
 }
-void apply_grad(Network *net, const Network *grad, float rate)
+XNN_TARGET("avx2,fma")
+static float hsum_avx2(__m256 v)
 {
-    if(!net||!grad) return;
-    for(size_t i=0;i<net->layers-1;i++){
-        size_t n = net->w[i]->rows*net->w[i]->cols;
-        for(size_t j=0;j<n;j++) net->w[i]->data[j] -= grad->w[i]->data[j]*rate;
-        n = net->b[i]->rows;
-        for(size_t j=0;j<n;j++) net->b[i]->data[j] -= grad->b[i]->data[j]*rate;
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+XNN_TARGET("avx2,fma")
+static float dot_avx2(const float *a, const float *b, size_t n)
+{
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i),    _mm256_loadu_ps(b+i),    s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+8),  _mm256_loadu_ps(b+i+8),  s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+16), _mm256_loadu_ps(b+i+16), s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+24), _mm256_loadu_ps(b+i+24), s3);
     }
+    for (; i + 8 <= n; i += 8) s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), s0);
+    float s = hsum_avx2(_mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+    for (; i < n; ++i) s += a[i]*b[i];
+    return s;
 }
-
-/* ---------- Save / Load ---------- */
-int network_save(const Network *net, const char *path)
+XNN_TARGET("avx2,fma") static float sumsq_avx2(const float *x, size_t n) { return dot_avx2(x, x, n); }
+XNN_TARGET("avx2,fma")
+static void add_avx2(float *y, const float *x, size_t n)
 {
-    FILE *f = fopen(path, "wb");
-    if (!f) return -1;
-    fwrite(&net->layers, sizeof(size_t), 1, f);
-    fwrite(&net->loss, sizeof(int), 1, f);
-    for (size_t i = 0; i < net->layers - 1; ++i) {
-        size_t w_sz = net->w[i]->rows * net->w[i]->cols;
-        size_t b_sz = net->b[i]->rows;
-        fwrite(net->w[i]->data, sizeof(float), w_sz, f);
-        fwrite(net->b[i]->data, sizeof(float), b_sz, f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(y+i, _mm256_add_ps(_mm256_loadu_ps(y+i), _mm256_loadu_ps(x+i)));
+    for (; i < n; ++i) y[i] += x[i];
+}
+XNN_TARGET("avx2,fma")
+static void axpy_avx2(float *y, float a, const float *x, size_t n)
+{
+    __m256 va = _mm256_set1_ps(a);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(y+i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x+i), _mm256_loadu_ps(y+i)));
+    for (; i < n; ++i) y[i] += a*x[i];
+}
+XNN_TARGET("avx2,fma")
+static void opt_avx2(const XnnOptStep *s, float *w, float *m, float *v, const float *g, size_t n)
+{
+    __m256 lr = _mm256_set1_ps(s->lr), keep = _mm256_set1_ps(s->keep), l2 = _mm256_set1_ps(s->l2);
+    __m256 b1 = _mm256_set1_ps(s->b1), a1 = _mm256_set1_ps(s->a1), b2 = _mm256_set1_ps(s->b2);
+    __m256 a2 = _mm256_set1_ps(s->a2), vs = _mm256_set1_ps(s->vs), eps = _mm256_set1_ps(s->eps);
+    __m256 gs = _mm256_set1_ps(s->gs), hi = _mm256_set1_ps(s->clip), lo = _mm256_set1_ps(-s->clip);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 wi = _mm256_loadu_ps(w+i), gi = _mm256_mul_ps(gs, _mm256_loadu_ps(g+i));
+        gi = _mm256_fmadd_ps(l2, wi, _mm256_max_ps(lo, _mm256_min_ps(hi, gi)));
+        __m256 u = gi;
+        if (m) { u = _mm256_fmadd_ps(b1, _mm256_loadu_ps(m+i), _mm256_mul_ps(a1, gi)); _mm256_storeu_ps(m+i, u); }
+        if (v) {
+            __m256 vi = _mm256_fmadd_ps(b2, _mm256_loadu_ps(v+i), _mm256_mul_ps(a2, _mm256_mul_ps(gi, gi)));
+            _mm256_storeu_ps(v+i, vi);
+            u = _mm256_div_ps(u, _mm256_fmadd_ps(_mm256_sqrt_ps(vi), vs, eps));
+        }
+        _mm256_storeu_ps(w+i, _mm256_fnmadd_ps(lr, u, _mm256_mul_ps(keep, wi)));
     }
-    fclose(f);
-    return 0;
+    opt_scalar(s, w+i, m ? m+i : NULL, v ? v+i : NULL, g+i, n-i);
 }
-
-Network *network_load(const char *path, const size_t *arch, size_t n, const int *act, int loss)
+XNN_TARGET("avx2,fma")
+static void u8f_avx2(float *y, const uint8_t *x, float s, size_t n)
 {
-    FILE *f = fopen(path, "rb");
-    if (!f) return NULL;
-
-    size_t layers;
-    int saved_loss;
-    if (fread(&layers, sizeof(size_t), 1, f) != 1 || layers != n) {
-        fclose(f);
-        return NULL;
+    __m256 vs = _mm256_set1_ps(s);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i b = _mm_loadl_epi64((const __m128i*)(x+i));
+        _mm256_storeu_ps(y+i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b)), vs));
     }
-    if (fread(&saved_loss, sizeof(int), 1, f) != 1 || saved_loss != loss) {
-        fclose(f);
-        return NULL;
+    for (; i < n; ++i) y[i] = x[i]*s;
+}
+XNN_TARGET("avx2,fma")
+static void scale_avx2(float *x, float s, size_t n)
+{
+    __m256 vs = _mm256_set1_ps(s);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(x+i, _mm256_mul_ps(_mm256_loadu_ps(x+i), vs));
+    for (; i < n; ++i) x[i] *= s;
+}
+XNN_TARGET("avx2,fma")
+static void fill_avx2(float *x, float v, size_t n)
+{
+    __m256 vv = _mm256_set1_ps(v);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(x+i, vv);
+    for (; i < n; ++i) x[i] = v;
+}
+XNN_TARGET("avx2,fma")
+static void relu_avx2(float *x, size_t n)
+{
+    __m256 z = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(x+i, _mm256_max_ps(_mm256_loadu_ps(x+i), z));
+    for (; i < n; ++i) if (x[i] < 0) x[i] = 0;
+}
+XNN_TARGET("avx2,fma")
+static __m256 exp_avx2(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(XNN_EXP_LO)), _mm256_set1_ps(XNN_EXP_HI));
+    __m256i ni = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(XNN_LOG2E)));
+    __m256 n = _mm256_cvtepi32_ps(ni);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(XNN_LN2_LO), _mm256_fnmadd_ps(n, _mm256_set1_ps(XNN_LN2_HI), x));
+    __m256 p = _mm256_set1_ps(XNN_EXP_P0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(XNN_EXP_P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(XNN_EXP_P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(XNN_EXP_P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(XNN_EXP_P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(XNN_EXP_P5));
+    p = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(p, r), r, r), _mm256_set1_ps(1.0f));
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(ni, _mm256_set1_epi32(127)), 23)));
+}
+XNN_TARGET("avx2,fma")
+static __m256 tanh_avx2(__m256 x)
+{
+    __m256 sign = _mm256_and_ps(x, _mm256_set1_ps(-0.0f)), ax = _mm256_xor_ps(x, sign);
+    __m256 z = _mm256_mul_ps(x, x), p = _mm256_set1_ps(XNN_TANH_P0);
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(XNN_TANH_P1));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(XNN_TANH_P2));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(XNN_TANH_P3));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(XNN_TANH_P4));
+    __m256 small = _mm256_fmadd_ps(_mm256_mul_ps(p, z), x, x);
+    __m256 e = exp_avx2(_mm256_add_ps(ax, ax));
+    __m256 big = _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(e, _mm256_set1_ps(1.0f))));
+    return _mm256_blendv_ps(_mm256_or_ps(big, sign), small, _mm256_cmp_ps(ax, _mm256_set1_ps(0.625f), _CMP_LT_OQ));
+}
+XNN_TARGET("avx2,fma")
+static void sigmoid_avx2(float *x, size_t n)
+{
+    __m256 one = _mm256_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(x+i, _mm256_div_ps(one, _mm256_add_ps(one, exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(x+i))))));
+    sigmoid_scalar(x+i, n-i);
+}
+XNN_TARGET("avx2,fma")
+static void tanh_avx2_n(float *x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(x+i, tanh_avx2(_mm256_loadu_ps(x+i)));
+    tanh_scalar(x+i, n-i);
+}
+XNN_TARGET("avx2,fma")
+static float expsum_avx2(float *x, float shift, size_t n)
+{
+    __m256 vs = _mm256_set1_ps(shift), acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 e = exp_avx2(_mm256_sub_ps(_mm256_loadu_ps(x+i), vs));
+        _mm256_storeu_ps(x+i, e);
+        acc = _mm256_add_ps(acc, e);
     }
-
-    Network *net = network_alloc(arch, n, act, loss);
-    if (!net) {
-        fclose(f);
-        return NULL;
+    return hsum_avx2(acc) + expsum_scalar(x+i, shift, n-i);
+}
+XNN_TARGET("avx2,fma")
+static void bf16_f32_avx2(float *y, const uint16_t *x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i*)(y+i),
+            _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(x+i))), 16));
+    bf16_f32_scalar(y+i, x+i, n-i);
+}
+XNN_TARGET("avx2,fma")
+static void f32_bf16_avx2(uint16_t *y, const float *x, size_t n)
+{
+    const __m256i bias = _mm256_set1_epi32(0x7fff), one = _mm256_set1_epi32(1), q = _mm256_set1_epi32(0x40);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i h[2];
+        for (int k = 0; k < 2; ++k) {
+            __m256 f = _mm256_loadu_ps(x+i+8*k);
+            __m256i u = _mm256_castps_si256(f);
+            __m256i r = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(u, bias),
+                                          _mm256_and_si256(_mm256_srli_epi32(u, 16), one)), 16);
+            __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(f, f, _CMP_UNORD_Q));
+            h[k] = _mm256_blendv_epi8(r, _mm256_or_si256(_mm256_srli_epi32(u, 16), q), nan);
+        }
+        __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi32(h[0], h[1]), 0xd8);
+        _mm256_storeu_si256((__m256i*)(y+i), p);
     }
-
-    for (size_t i = 0; i < n - 1; ++i) {
-        size_t w_sz = net->w[i]->rows * net->w[i]->cols;
-        size_t b_sz = net->b[i]->rows;
-        if (fread(net->w[i]->data, sizeof(float), w_sz, f) != w_sz ||
-            fread(net->b[i]->data, sizeof(float), b_sz, f) != b_sz) {
-            network_free(net);
-            fclose(f);
-            return NULL;
+    f32_bf16_scalar(y+i, x+i, n-i);
+}
+XNN_TARGET("avx2,fma,f16c")
+static void fp16_f32_f16c(float *y, const uint16_t *x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(y+i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(x+i))));
+    fp16_f32_scalar(y+i, x+i, n-i);
+}
+XNN_TARGET("avx2,fma,f16c")
+static void f32_fp16_f16c(uint16_t *y, const float *x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i*)(y+i), _mm256_cvtps_ph(_mm256_loadu_ps(x+i), _MM_FROUND_TO_NEAREST_INT));
+    f32_fp16_scalar(y+i, x+i, n-i);
+}
+/* u8 x s8 widened to 16 bits, so vpmaddwd cannot saturate (vpmaddubsw can) */
+XNN_TARGET("avx2,fma")
+static int32_t dot_q8_avx2(const uint8_t *a, const int8_t *w, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 16)
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(a+i))),
+                                                      _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(w+i)))));
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+    return _mm_cvtsi128_si32(s);
+}
+XNN_TARGET("avx2,fma")
+static void spmv_b4_avx2(float *y, const uint32_t *ptr, const uint32_t *col, const float *val,
+                         size_t nb, const float *x)
+{
+    for (size_t r = 0; r < nb; ++r) {
+        __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+        uint32_t k = ptr[r];
+        for (; k + 2 <= ptr[r+1]; k += 2) {
+            s0 = _mm_fmadd_ps(_mm_loadu_ps(val + 4*k), _mm_set1_ps(x[col[k]]), s0);
+            s1 = _mm_fmadd_ps(_mm_loadu_ps(val + 4*k+4), _mm_set1_ps(x[col[k+1]]), s1);
         }
+        if (k < ptr[r+1]) s0 = _mm_fmadd_ps(_mm_loadu_ps(val + 4*k), _mm_set1_ps(x[col[k]]), s0);
+        _mm_storeu_ps(y + 4*r, _mm_add_ps(s0, s1));
     }
-
-    fclose(f);
-    return net;
 }
-
-/* ---------- Utilities ---------- */
-Matrix *matrix_from_csv(const char *path, size_t rows, size_t cols)
+XNN_TARGET("avx2,fma")
+static void spmv_b8_avx2(float *y, const uint32_t *ptr, const uint32_t *col, const float *val,
+                         size_t nb, const float *x)
 {
-    FILE *f = fopen(path, "r");
-    if (!f) return NULL;
-    Matrix *m = matrix_alloc(rows, cols);
-    if (!m) { fclose(f); return NULL; }
-    for (size_t i = 0; i < rows; ++i)
-        for (size_t j = 0; j < cols; ++j)
-            if (fscanf(f, "%f,", &m->data[i*cols + j]) != 1)
-                goto fail;
-    fclose(f);
-    return m;
-fail:
-    matrix_free(m);
-    fclose(f);
-    return NULL;
+    for (size_t r = 0; r < nb; ++r) {
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        uint32_t k = ptr[r];
+        for (; k + 2 <= ptr[r+1]; k += 2) {
+            s0 = _mm256_fmadd_ps(_mm256_loadu_ps(val + 8*k), _mm256_set1_ps(x[col[k]]), s0);
+            s1 = _mm256_fmadd_ps(_mm256_loadu_ps(val + 8*k+8), _mm256_set1_ps(x[col[k+1]]), s1);
+        }
+        if (k < ptr[r+1]) s0 = _mm256_fmadd_ps(_mm256_loadu_ps(val + 8*k), _mm256_set1_ps(x[col[k]]), s0);
+        _mm256_storeu_ps(y + 8*r, _mm256_add_ps(s0, s1));
+    }
 }
 
-float network_mse(const Network *net, const Data *data)
+/* AVX-512F: 8x32 tile, 16 zmm accumulators; tails use masked ops */
+XNN_TARGET("avx512f")
+static void gemm_kernel_avx512(size_t kc, const float *a, const float *b, float *c, size_t ldc,
+                               float alpha, float beta)
 {
-    if (!net || !data || !data->in || !data->out) return 0.0f;
-    size_t batch = data->in->rows;
-    size_t in_sz = data->in->cols;
-    size_t out_sz = data->out->cols;
-    size_t L = net->layers - 1;
-    if (in_sz != net->a[0]->rows || out_sz != net->a[L]->rows) return 0.0f;
-
-    /* Clone the network so we don't mutate the original */
-    size_t *tmp_arch = malloc(net->layers * sizeof(size_t));
-    int *tmp_act = malloc(net->layers * sizeof(int));
-    for (size_t i = 0; i < net->layers; ++i) {
-        tmp_arch[i] = net->a[i]->rows;
-        tmp_act[i]  = net->activations[i];
-    }
-    Network *tmp = network_alloc(tmp_arch, net->layers, tmp_act, net->loss);
-    free(tmp_arch); free(tmp_act);
-    if (!tmp) return 0.0f;
-    for (size_t i = 0; i < net->layers - 1; ++i) {
-        matrix_copy(tmp->w[i], net->w[i]);
-        matrix_copy(tmp->b[i], net->b[i]);
+    __m512 acc[8][2];
+    for (int i = 0; i < 8; ++i) acc[i][0] = acc[i][1] = _mm512_setzero_ps();
+    for (size_t k = 0; k < kc; ++k, a += 8, b += 32) {
+        __m512 b0 = _mm512_loadu_ps(b), b1 = _mm512_loadu_ps(b + 16);
+        for (int i = 0; i < 8; ++i) {
+            __m512 x = _mm512_set1_ps(a[i]);
+            acc[i][0] = _mm512_fmadd_ps(x, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(x, b1, acc[i][1]);
+        }
     }
-
-    float loss = 0.0f;
-    for (size_t s = 0; s < batch; ++s) {
-        memcpy(tmp->a[0]->data, &data->in->data[s * in_sz], in_sz * sizeof(float));
-        forward(tmp);
-        for (size_t j = 0; j < out_sz; ++j) {
-            float d = tmp->a[L]->data[j] - data->out->data[s * out_sz + j];
-            loss += d * d;
+    __m512 va = _mm512_set1_ps(alpha), vb = _mm512_set1_ps(beta);
+    for (int i = 0; i < 8; ++i)
+        for (int h = 0; h < 2; ++h) {
+            float *p = c + i*ldc + h*16;
+            __m512 r = _mm512_mul_ps(va, acc[i][h]);
+            if (beta != 0.0f) r = _mm512_fmadd_ps(vb, _mm512_loadu_ps(p), r);
+            _mm512_storeu_ps(p, r);
         }
+}
+XNN_TARGET("avx512f")
+static float dot_avx512(const float *a, const float *b, size_t n)
+{
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a+i),    _mm512_loadu_ps(b+i),    s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a+i+16), _mm512_loadu_ps(b+i+16), s1);
     }
-    network_free(tmp);
-    return loss / batch;
+    if (i + 16 <= n) { s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a+i), _mm512_loadu_ps(b+i), s0); i += 16; }
+    __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+    s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a+i), _mm512_maskz_loadu_ps(m, b+i), s1);
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
 }
-
-void network_predict(const Network *net, const float *input, float *output)
+XNN_TARGET("avx512f") static float sumsq_avx512(const float *x, size_t n) { return dot_avx512(x, x, n); }
+XNN_TARGET("avx512f")
+static void add_avx512(float *y, const float *x, size_t n)
 {
-    if (!net || !input || !output) return;
-    memcpy(net->a[0]->data, input, net->a[0]->rows * sizeof(float));
-    forward((Network*)net);
-    memcpy(output, net->a[net->layers - 1]->data, net->a[net->layers - 1]->rows * sizeof(float));
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(y+i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, y+i), _mm512_maskz_loadu_ps(m, x+i)));
+    }
+}
+XNN_TARGET("avx512f")
+static void axpy_avx512(float *y, float a, const float *x, size_t n)
+{
+    __m512 va = _mm512_set1_ps(a);
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(y+i, m, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x+i), _mm512_maskz_loadu_ps(m, y+i)));
+    }
+}
+XNN_TARGET("avx512f")
+static void opt_avx512(const XnnOptStep *s, float *w, float *m, float *v, const float *g, size_t n)
+{
+    __m512 lr = _mm512_set1_ps(s->lr), keep = _mm512_set1_ps(s->keep), l2 = _mm512_set1_ps(s->l2);
+    __m512 b1 = _mm512_set1_ps(s->b1), a1 = _mm512_set1_ps(s->a1), b2 = _mm512_set1_ps(s->b2);
+    __m512 a2 = _mm512_set1_ps(s->a2), vs = _mm512_set1_ps(s->vs), eps = _mm512_set1_ps(s->eps);
+    __m512 gs = _mm512_set1_ps(s->gs), hi = _mm512_set1_ps(s->clip), lo = _mm512_set1_ps(-s->clip);
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 k = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        __m512 wi = _mm512_maskz_loadu_ps(k, w+i), gi = _mm512_mul_ps(gs, _mm512_maskz_loadu_ps(k, g+i));
+        gi = _mm512_fmadd_ps(l2, wi, _mm512_max_ps(lo, _mm512_min_ps(hi, gi)));
+        __m512 u = gi;
+        if (m) { u = _mm512_fmadd_ps(b1, _mm512_maskz_loadu_ps(k, m+i), _mm512_mul_ps(a1, gi)); _mm512_mask_storeu_ps(m+i, k, u); }
+        if (v) {
+            __m512 vi = _mm512_fmadd_ps(b2, _mm512_maskz_loadu_ps(k, v+i), _mm512_mul_ps(a2, _mm512_mul_ps(gi, gi)));
+            _mm512_mask_storeu_ps(v+i, k, vi);
+            u = _mm512_div_ps(u, _mm512_fmadd_ps(_mm512_sqrt_ps(vi), vs, eps));
+        }
+        _mm512_mask_storeu_ps(w+i, k, _mm512_fnmadd_ps(lr, u, _mm512_mul_ps(keep, wi)));
+    }
+}
+XNN_TARGET("avx512f")
+static void u8f_avx512(float *y, const uint8_t *x, float s, size_t n)
+{
+    __m512 vs = _mm512_set1_ps(s);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)(x+i));
+        _mm512_storeu_ps(y+i, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(b)), vs));
+    }
+    for (; i < n; ++i) y[i] = x[i]*s;
+}
+XNN_TARGET("avx512f")
+static void scale_avx512(float *x, float s, size_t n)
+{
+    __m512 vs = _mm512_set1_ps(s);
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(x+i, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, x+i), vs));
+    }
+}
+XNN_TARGET("avx512f")
+static void fill_avx512(float *x, float v, size_t n)
+{
+    __m512 vv = _mm512_set1_ps(v);
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(x+i, m, vv);
+    }
+}
+XNN_TARGET("avx512f")
+static void relu_avx512(float *x, size_t n)
+{
+    __m512 z = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(x+i, m, _mm512_max_ps(_mm512_maskz_loadu_ps(m, x+i), z));
+    }
+}
+XNN_TARGET("avx512f")
+static __m512 exp_avx512(__m512 x)
+{
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(XNN_EXP_LO)), _mm512_set1_ps(XNN_EXP_HI));
+    __m512i ni = _mm512_cvtps_epi32(_mm512_mul_ps(x, _mm512_set1_ps(XNN_LOG2E)));
+    __m512 n = _mm512_cvtepi32_ps(ni);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(XNN_LN2_LO), _mm512_fnmadd_ps(n, _mm512_set1_ps(XNN_LN2_HI), x));
+    __m512 p = _mm512_set1_ps(XNN_EXP_P0);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(XNN_EXP_P1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(XNN_EXP_P2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(XNN_EXP_P3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(XNN_EXP_P4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(XNN_EXP_P5));
+    p = _mm512_add_ps(_mm512_fmadd_ps(_mm512_mul_ps(p, r), r, r), _mm512_set1_ps(1.0f));
+    return _mm512_mul_ps(p, _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(ni, _mm512_set1_epi32(127)), 23)));
+}
+XNN_TARGET("avx512f")
+static __m512 tanh_avx512(__m512 x)
+{
+    __m512i sign = _mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32((int)0x80000000u));
+    __m512 ax = _mm512_abs_ps(x);
+    __m512 z = _mm512_mul_ps(x, x), p = _mm512_set1_ps(XNN_TANH_P0);
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(XNN_TANH_P1));
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(XNN_TANH_P2));
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(XNN_TANH_P3));
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(XNN_TANH_P4));
+    __m512 small = _mm512_fmadd_ps(_mm512_mul_ps(p, z), x, x);
+    __m512 e = exp_avx512(_mm512_add_ps(ax, ax));
+    __m512 big = _mm512_sub_ps(_mm512_set1_ps(1.0f), _mm512_div_ps(_mm512_set1_ps(2.0f), _mm512_add_ps(e, _mm512_set1_ps(1.0f))));
+    big = _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(big), sign));
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(ax, _mm512_set1_ps(0.625f), _CMP_LT_OQ), big, small);
+}
+XNN_TARGET("avx512f")
+static void sigmoid_avx512(float *x, size_t n)
+{
+    __m512 one = _mm512_set1_ps(1.0f);
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        __m512 v = _mm512_maskz_loadu_ps(m, x+i);
+        _mm512_mask_storeu_ps(x+i, m, _mm512_div_ps(one, _mm512_add_ps(one, exp_avx512(_mm512_sub_ps(_mm512_setzero_ps(), v)))));
+    }
+}
+XNN_TARGET("avx512f")
+static void tanh_avx512_n(float *x, size_t n)
+{
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(x+i, m, tanh_avx512(_mm512_maskz_loadu_ps(m, x+i)));
+    }
+}
+XNN_TARGET("avx512f")
+static float expsum_avx512(float *x, float shift, size_t n)
+{
+    __m512 vs = _mm512_set1_ps(shift), acc = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        __m512 e = exp_avx512(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, x+i), vs));
+        _mm512_mask_storeu_ps(x+i, m, e);
+        acc = _mm512_mask_add_ps(acc, m, acc, e);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+XNN_TARGET("avx512f")
+static void bf16_f32_avx512(float *y, const uint16_t *x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_si512(y+i,
+            _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(x+i))), 16));
+    bf16_f32_scalar(y+i, x+i, n-i);
+}
+/* vcvtneps2bf16 treats fp32 subnormals as zero; nothing a weight can be */
+XNN_TARGET("avx512f,avx512bf16,avx512vl")
+static void f32_bf16_avx512bf16(uint16_t *y, const float *x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i*)(y+i), (__m256i)_mm512_cvtneps_pbh(_mm512_loadu_ps(x+i)));
+    f32_bf16_scalar(y+i, x+i, n-i);
+}
+XNN_TARGET("avx512f")
+static void fp16_f32_avx512(float *y, const uint16_t *x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) _mm512_storeu_ps(y+i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(x+i))));
+    fp16_f32_scalar(y+i, x+i, n-i);
+}
+XNN_TARGET("avx512f")
+static void f32_fp16_avx512(uint16_t *y, const float *x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i*)(y+i), _mm512_cvtps_ph(_mm512_loadu_ps(x+i), _MM_FROUND_TO_NEAREST_INT));
+    f32_fp16_scalar(y+i, x+i, n-i);
+}
+XNN_TARGET("avx512f,avx512bw")
+static int32_t dot_q8_avx512bw(const uint8_t *a, const int8_t *w, size_t n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < n; i += 32)
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(a+i))),
+                                                      _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)(w+i)))));
+    return _mm512_reduce_add_epi32(acc);
+}
+/* VNNI: vpdpbusd multiplies u8 by s8 and sums groups of four into s32 */
+XNN_TARGET("avx512f,avx512vnni")
+static int32_t dot_q8_vnni(const uint8_t *a, const int8_t *w, size_t n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < n; i += 64)
+        acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(a+i), _mm512_loadu_si512(w+i));
+    return _mm512_reduce_add_epi32(acc);
+}
+#pragma GCC diagnostic pop
+#endif /* XNN_X86 */
+
+static int xnn_cpu_isa(void)
+{
+#ifdef XNN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return ISA_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return ISA_AVX2;
+    if (__builtin_cpu_supports("sse2")) return ISA_SSE2;
+#endif
+    return ISA_SCALAR;
+}
+
+int xnn_set_isa(int isa)
+{
+    int best = xnn_cpu_isa();
+    if (isa < 0) {
+        const char *env = getenv("XNN_ISA");
+        isa = best;
+        if (env)
+            for (int i = ISA_SCALAR; i <= ISA_AVX512; ++i)
+                if (!strcmp(env, xnn_isa_name(i))) isa = i;
+    }
+    if (isa > best) isa = best;
+
+    XnnKernels k = { ISA_SCALAR, 4, 8, gemm_kernel_scalar, dot_scalar, sumsq_scalar,
+                     add_scalar, axpy_scalar, scale_scalar, fill_scalar, relu_scalar,
+                     sigmoid_scalar, tanh_scalar, expsum_scalar,
+                     {bf16_f32_scalar, fp16_f32_scalar}, {f32_bf16_scalar, f32_fp16_scalar},
+                     dot_q8_scalar, {spmv_csr_scalar, spmv_b4_scalar, spmv_b8_scalar}, opt_scalar, u8f_scalar };
+#ifdef XNN_X86
+    if (isa == ISA_SSE2) {
+        XnnKernels s = { ISA_SSE2, 4, 8, gemm_kernel_sse2, dot_sse2, sumsq_sse2,
+                         add_sse2, axpy_sse2, scale_sse2, fill_sse2, relu_sse2,
+                         sigmoid_sse2, tanh_sse2_n, expsum_sse2,
+                         {bf16_f32_sse2, fp16_f32_scalar}, {f32_bf16_scalar, f32_fp16_scalar},
+                         dot_q8_sse2, {spmv_csr_scalar, spmv_b4_sse2, spmv_b8_scalar}, opt_scalar, u8f_scalar };
+        k = s;
+    } else if (isa == ISA_AVX2) {
+        XnnKernels s = { ISA_AVX2, 6, 16, gemm_kernel_avx2, dot_avx2, sumsq_avx2,
+                         add_avx2, axpy_avx2, scale_avx2, fill_avx2, relu_avx2,
+                         sigmoid_avx2, tanh_avx2_n, expsum_avx2,
+                         {bf16_f32_avx2, fp16_f32_scalar}, {f32_bf16_avx2, f32_fp16_scalar},
+                         dot_q8_avx2, {spmv_csr_scalar, spmv_b4_avx2, spmv_b8_avx2}, opt_avx2, u8f_avx2 };
+        if (__builtin_cpu_supports("f16c")) s.h2f[1] = fp16_f32_f16c, s.f2h[1] = f32_fp16_f16c;
+        k = s;
+    } else if (isa == ISA_AVX512) {
+        XnnKernels s = { ISA_AVX512, 8, 32, gemm_kernel_avx512, dot_avx512, sumsq_avx512,
+                         add_avx512, axpy_avx512, scale_avx512, fill_avx512, relu_avx512,
+                         sigmoid_avx512, tanh_avx512_n, expsum_avx512,
+                         {bf16_f32_avx512, fp16_f32_avx512}, {f32_bf16_avx2, f32_fp16_avx512},
+                         dot_q8_avx2, {spmv_csr_scalar, spmv_b4_avx2, spmv_b8_avx2}, opt_avx512, u8f_avx512 };
+        if (__builtin_cpu_supports("avx512bf16")) s.f2h[0] = f32_bf16_avx512bf16;
+        if (__builtin_cpu_supports("avx512bw")) s.dot_q8 = dot_q8_avx512bw;
+        if (__builtin_cpu_supports("avx512vnni")) s.dot_q8 = dot_q8_vnni;
+        k = s;
+    }
+#endif
+    xnn_k = k;
+    return xnn_k.isa;
+}
+const char *xnn_isa_name(int isa)
+{
+    static const char *names[] = {"scalar", "sse2", "avx2", "avx512"};
+    return isa >= ISA_SCALAR && isa <= ISA_AVX512 ? names[isa] : "unknown";
+}
+/* First use picks the best ISA once, even with several threads racing to
+ * it; an explicit xnn_set_isa before that wins. */
+static pthread_once_t xnn_k_once = PTHREAD_ONCE_INIT;
+static void xnn_k_init(void) { if (xnn_k.isa < 0) xnn_set_isa(-1); }
+static const XnnKernels *xk(void)
+{
+    pthread_once(&xnn_k_once, xnn_k_init);
+    return &xnn_k;
+}
+
+/* ---------- Memory ----------
+ * Numeric buffers (matrix data, parameters, gradients, pack and batch
+ * buffers) come from xnn_alloc: 64-byte aligned, carved out of XNN_MALLOC
+ * (define XNN_MALLOC/XNN_FREE before the implementation to plug in an
+ * allocator). Blocks of XNN_HUGE_MIN bytes or more are aligned to 2 MB and
+ * madvise'd for transparent huge pages, so gathering batches out of a big
+ * training set doesn't miss the TLB on every row; -DXNN_HUGE_PAGES=0 to
+ * opt out. The raw pointer sits just below the aligned one. */
+#ifndef XNN_MALLOC
+#define XNN_MALLOC(sz) malloc(sz)
+#define XNN_FREE(p)    free(p)
+#endif
+#ifndef XNN_HUGE_PAGES
+#define XNN_HUGE_PAGES 1
+#endif
+#define XNN_ALIGN     64
+#define XNN_HUGE_PAGE ((size_t)2 << 20)
+#define XNN_HUGE_MIN  ((size_t)4 << 20)   // below this the 2 MB padding costs too much
+
+static void *xnn_alloc(size_t bytes)
+{
+    size_t align = XNN_HUGE_PAGES && bytes >= XNN_HUGE_MIN ? XNN_HUGE_PAGE : XNN_ALIGN;
+    char *raw = (char*)XNN_MALLOC(bytes + align + sizeof(void*));
+    if (!raw) return NULL;
+    char *p = (char*)(((uintptr_t)raw + sizeof(void*) + align-1) & ~(uintptr_t)(align-1));
+    ((void**)p)[-1] = raw;
+#if XNN_HUGE_PAGES && defined(MADV_HUGEPAGE)
+    if (align == XNN_HUGE_PAGE) madvise(p, bytes & ~(XNN_HUGE_PAGE-1), MADV_HUGEPAGE);
+#endif
+    return p;
+}
+static void xnn_free(void *p) { if (p) XNN_FREE(((void**)p)[-1]); }
+
+/* ---------- Matrix ---------- */
+Matrix *matrix_alloc(size_t r, size_t c)
+{
+    if (!r || !c) return NULL;
+    Matrix *m = malloc(sizeof*m);
+    if (!m) return NULL;
+    m->rows = r; m->cols = c;
+    m->data = xnn_alloc(r*c*sizeof(float));
+    if (!m->data) { free(m); return NULL; }
+    return m;
+}
+void matrix_free(Matrix *m){ if(m){xnn_free(m->data);free(m);} }
+
+int matrix_copy(Matrix *dst, const Matrix *src)
+{
+    if (!dst || !src || dst->rows != src->rows || dst->cols != src->cols) return -1;
+    memcpy(dst->data, src->data, src->rows * src->cols * sizeof(float));
+    return 0;
+}
+float rand_float(float lo, float hi)
+{ return lo + (float)rand()/RAND_MAX * (hi-lo); }
+void matrix_rand(Matrix *m, float lo, float hi)
+{ for(size_t i=0;i<m->rows*m->cols;i++) m->data[i]=rand_float(lo,hi); }
+void matrix_rand_bias(Matrix *m){ matrix_rand(m,-0.1f,0.1f); }
+void matrix_fill(Matrix *m, float v)
+{ xk()->fill(m->data, v, m->rows*m->cols); }
+void matrix_print(const Matrix *m)
+{
+    for(size_t i=0;i<m->rows;i++){
+        for(size_t j=0;j<m->cols;j++) printf("%.5f ",m->data[i*m->cols+j]);
+        printf("\n");
+    }
+}
+float matrix_norm(const Matrix *m)
+{
+    if (!m) return 0.0f;
+    return sqrtf(xk()->sumsq(m->data, m->rows * m->cols));
+}
+int matrix_sum(Matrix *dst, const Matrix *src)
+{
+    if(!dst||!src||dst->rows!=src->rows||dst->cols!=src->cols) return -1;
+    xk()->add(dst->data, src->data, dst->rows*dst->cols);
+    return 0;
+}
+int matrix_dot(Matrix *dst, const Matrix *a, const Matrix *b)
+{ return matrix_gemm(dst, a, b, 0, 0, 1.0f, 0.0f); }
+
+/* ---------- Tensor views ---------- */
+static Tensor tensor_bad(void) { Tensor t; memset(&t, 0, sizeof t); return t; }
+static int tensor_ok(const Tensor *t) { return t->data || t->u8; }
+Tensor matrix_view(const Matrix *m)
+{
+    Tensor t = tensor_bad();
+    if (!m) return t;
+    t.data = m->data; t.ndim = 2;
+    t.shape[0] = m->rows; t.shape[1] = m->cols;
+    t.stride[0] = (ptrdiff_t)m->cols; t.stride[1] = 1;
+    return t;
+}
+Tensor tensor_slice(Tensor t, int dim, size_t begin, size_t end)
+{
+    if (!tensor_ok(&t) || dim < 0 || dim >= t.ndim || begin > end || end > t.shape[dim]) return tensor_bad();
+    if (dim == 0 && t.index) t.index += begin;
+    else if (t.u8) t.u8 += (ptrdiff_t)begin*t.stride[dim];
+    else t.data += (ptrdiff_t)begin*t.stride[dim];
+    t.shape[dim] = end - begin;
+    return t;
+}
+Tensor tensor_transpose(Tensor t, int d0, int d1)
+{
+    if (!tensor_ok(&t) || d0 < 0 || d1 < 0 || d0 >= t.ndim || d1 >= t.ndim) return tensor_bad();
+    if (t.index && (d0 == 0 || d1 == 0) && d0 != d1) return tensor_bad();   // the index stays on dim 0
+    size_t n = t.shape[d0]; t.shape[d0] = t.shape[d1]; t.shape[d1] = n;
+    ptrdiff_t s = t.stride[d0]; t.stride[d0] = t.stride[d1]; t.stride[d1] = s;
+    return t;
+}
+Tensor tensor_reshape(Tensor t, int ndim, const size_t *shape)
+{
+    if (!tensor_ok(&t) || t.index || ndim < 1 || ndim > XNN_MAX_DIMS || !shape) return tensor_bad();
+    size_t n = 1, m = 1;
+    for (int d = t.ndim-1; d >= 0; --d) {
+        if (t.shape[d] > 1 && t.stride[d] != (ptrdiff_t)n) return tensor_bad();
+        n *= t.shape[d];
+    }
+    for (int d = 0; d < ndim; ++d) m *= shape[d];
+    if (m != n) return tensor_bad();
+    t.ndim = ndim;
+    ptrdiff_t st = 1;
+    for (int d = ndim-1; d >= 0; --d) { t.shape[d] = shape[d]; t.stride[d] = st; st *= (ptrdiff_t)shape[d]; }
+    return t;
+}
+Tensor tensor_gather(Tensor t, const size_t *index, size_t n)
+{
+    if (!tensor_ok(&t) || t.index || !index) return tensor_bad();
+    for (size_t i = 0; i < n; ++i) if (index[i] >= t.shape[0]) return tensor_bad();
+    t.index = index;
+    t.shape[0] = n;
+    return t;
+}
+float *tensor_row(const Tensor *t, size_t i)
+{ return t->u8 ? NULL : t->data + (ptrdiff_t)(t->index ? t->index[i] : i)*t->stride[0]; }
+Tensor tensor_u8(const uint8_t *data, size_t rows, size_t cols, float scale)
+{
+    Tensor t = tensor_bad();
+    if (!data) return t;
+    t.u8 = data; t.scale = scale; t.ndim = 2;
+    t.shape[0] = rows; t.shape[1] = cols;
+    t.stride[0] = (ptrdiff_t)cols; t.stride[1] = 1;
+    return t;
+}
+void tensor_copy_row(const Tensor *t, size_t i, float *dst)
+{
+    size_t n = t->shape[1];
+    ptrdiff_t cs = t->stride[1], off = (ptrdiff_t)(t->index ? t->index[i] : i)*t->stride[0];
+    if (t->u8 && cs == 1) xk()->u8f(dst, t->u8 + off, t->scale, n);
+    else if (t->u8) for (size_t j = 0; j < n; ++j) dst[j] = t->u8[off + (ptrdiff_t)j*cs]*t->scale;
+    else if (cs == 1) memcpy(dst, t->data + off, n*sizeof(float));
+    else for (size_t j = 0; j < n; ++j) dst[j] = t->data[off + (ptrdiff_t)j*cs];
+}
+
+/* The network side reads views as rows x cols with one column stride:
+ * dims 1.. fold into one when they are laid out back to back. */
+static int tensor_flat2(const Tensor *t, size_t cols, Tensor *v)
+{
+    if (!t || !tensor_ok(t) || t->ndim < 1) return -1;
+    size_t n = 1;
+    ptrdiff_t cs = 1;
+    for (int d = t->ndim-1; d >= 1; --d) {
+        if (t->shape[d] == 1) continue;
+        if (n == 1) cs = t->stride[d];
+        else if (t->stride[d] != cs*(ptrdiff_t)n) return -1;
+        n *= t->shape[d];
+    }
+    if (n != cols) return -1;
+    *v = *t;
+    v->ndim = 2;
+    v->shape[1] = n;
+    v->stride[1] = cs;
+    return 0;
+}
+
+/* ---------- GEMM ----------
+ * Goto-style blocked SGEMM: B is packed into KC x NC panels of NR-wide
+ * slivers, A into MC x KC blocks of MR-tall slivers, and the ISA's
+ * MR x NR register-tiled micro-kernel walks the packed data contiguously.
+ * Operands are addressed through (row, col) strides so transposes are
+ * free. C = alpha*op(A)*op(B) + beta*C; beta == 0 never reads C. */
+#define XNN_MC 96      /* multiple of every MR */
+#define XNN_KC 256
+#define XNN_NC 2048    /* multiple of every NR */
+#define XNN_GEMM_SMALL 4096   /* M*N*K below this skips packing */
+
+static __thread float *xnn_pack;
+static __thread size_t xnn_pack_cap;
+static pthread_key_t xnn_pack_key;   /* frees a thread's buffer when it exits */
+static pthread_once_t xnn_pack_once = PTHREAD_ONCE_INIT;
+
+static void xnn_pack_init(void) { pthread_key_create(&xnn_pack_key, xnn_free); }
+static float *xnn_pack_buf(size_t n)
+{
+    if (n > xnn_pack_cap) {
+        pthread_once(&xnn_pack_once, xnn_pack_init);
+        xnn_free(xnn_pack);
+        xnn_pack = xnn_alloc(n * sizeof(float));
+        xnn_pack_cap = xnn_pack ? n : 0;
+        pthread_setspecific(xnn_pack_key, xnn_pack);
+    }
+    return xnn_pack;
+}
+
+/* Packing reads along whichever stride is contiguous. */
+static void xnn_pack_a(size_t mc, size_t kc, size_t mr, const float *A, ptrdiff_t rs, ptrdiff_t cs, float *p)
+{
+    for (size_t i0 = 0; i0 < mc; i0 += mr, p += mr*kc) {
+        size_t m = mc-i0 < mr ? mc-i0 : mr;
+        if (cs == 1) {
+            for (size_t i = 0; i < mr; ++i)
+                for (size_t k = 0; k < kc; ++k)
+                    p[k*mr+i] = i < m ? A[(ptrdiff_t)(i0+i)*rs + (ptrdiff_t)k] : 0.0f;
+        } else {
+            for (size_t k = 0; k < kc; ++k)
+                for (size_t i = 0; i < mr; ++i)
+                    p[k*mr+i] = i < m ? A[(ptrdiff_t)(i0+i)*rs + (ptrdiff_t)k*cs] : 0.0f;
+        }
+    }
+}
+
+/* n half-precision values at stride inc -> fp32 */
+static void xnn_h2f(float *y, const uint16_t *x, ptrdiff_t inc, size_t n, int prec)
+{
+    if (inc == 1) { xk()->h2f[prec-1](y, x, n); return; }
+    for (size_t i = 0; i < n; ++i)
+        y[i] = prec == PREC_BF16 ? bf16_f32(x[(ptrdiff_t)i*inc]) : fp16_f32(x[(ptrdiff_t)i*inc]);
+}
+static float xnn_ld(const void *p, ptrdiff_t i, int prec)
+{
+    if (prec == PREC_FP32) return ((const float*)p)[i];
+    uint16_t h = ((const uint16_t*)p)[i];
+    return prec == PREC_BF16 ? bf16_f32(h) : fp16_f32(h);
+}
+
+/* B may be stored in bf16/fp16 (prec); it is widened here, once per block. */
+static void xnn_pack_b(size_t kc, size_t nc, size_t nr, const void *Bv, int prec, ptrdiff_t rs, ptrdiff_t cs, float *p)
+{
+    if (prec != PREC_FP32) {
+        const uint16_t *B = (const uint16_t*)Bv;
+        float t[XNN_KC > XNN_NR_MAX ? XNN_KC : XNN_NR_MAX];
+        for (size_t j0 = 0; j0 < nc; j0 += nr, p += nr*kc) {
+            size_t n = nc-j0 < nr ? nc-j0 : nr;
+            if (rs == 1) {
+                for (size_t j = 0; j < nr; ++j) {
+                    if (j < n) xnn_h2f(t, B + (ptrdiff_t)(j0+j)*cs, 1, kc, prec);
+                    for (size_t k = 0; k < kc; ++k) p[k*nr+j] = j < n ? t[k] : 0.0f;
+                }
+            } else {
+                for (size_t k = 0; k < kc; ++k) {
+                    xnn_h2f(t, B + (ptrdiff_t)k*rs + (ptrdiff_t)j0*cs, cs, n, prec);
+                    for (size_t j = 0; j < nr; ++j) p[k*nr+j] = j < n ? t[j] : 0.0f;
+                }
+            }
+        }
+        return;
+    }
+    const float *B = (const float*)Bv;
+    for (size_t j0 = 0; j0 < nc; j0 += nr, p += nr*kc) {
+        size_t n = nc-j0 < nr ? nc-j0 : nr;
+        if (rs == 1) {
+            for (size_t j = 0; j < nr; ++j)
+                for (size_t k = 0; k < kc; ++k)
+                    p[k*nr+j] = j < n ? B[(ptrdiff_t)k + (ptrdiff_t)(j0+j)*cs] : 0.0f;
+        } else {
+            for (size_t k = 0; k < kc; ++k)
+                for (size_t j = 0; j < nr; ++j)
+                    p[k*nr+j] = j < n ? B[(ptrdiff_t)k*rs + (ptrdiff_t)(j0+j)*cs] : 0.0f;
+        }
+    }
+}
+
+/* y = alpha*A*x + beta*y; A may be bf16/fp16 (prec), widened KC at a time */
+static void xnn_gemv(size_t M, size_t K, float alpha, const void *Av, int prec, ptrdiff_t rs, ptrdiff_t cs,
+                     const float *x, ptrdiff_t incx, float beta, float *y, size_t incy)
+{
+    const XnnKernels *k = xk();
+    float t[XNN_KC];
+    for (size_t i = 0; i < M; ++i) {
+        float s = 0.0f;
+        if (prec != PREC_FP32) {
+            const uint16_t *r = (const uint16_t*)Av + (ptrdiff_t)i*rs;
+            for (size_t j = 0; j < K; j += XNN_KC) {
+                size_t n = K-j < XNN_KC ? K-j : XNN_KC;
+                xnn_h2f(t, r + (ptrdiff_t)j*cs, cs, n, prec);
+                if (incx == 1) s += k->dot(t, x + j, n);
+                else for (size_t q = 0; q < n; ++q) s += t[q] * x[(ptrdiff_t)(j+q)*incx];
+            }
+        } else {
+            const float *r = (const float*)Av + (ptrdiff_t)i*rs;
+            if (cs == 1 && incx == 1) s = k->dot(r, x, K);
+            else for (size_t j = 0; j < K; ++j) s += r[(ptrdiff_t)j*cs] * x[(ptrdiff_t)j*incx];
+        }
+        y[i*incy] = alpha*s + (beta == 0.0f ? 0.0f : beta*y[i*incy]);
+    }
+}
+
+/* Epilogue run on each C tile as its last K block lands, while it is
+ * still in cache: C = f(C + bias), optionally recording f'(z) for the
+ * backward pass -- a bitmask for ReLU (bit j%32 of word j/32 in each
+ * row), the float derivative for sigmoid/tanh. bias[i*brs + j*bcs]
+ * covers both a per-column (row-major batch) and per-row (column
+ * vector) bias. act < 0 or softmax (needs the whole row) is left to
+ * the caller. */
+typedef struct {
+    const float *bias;
+    ptrdiff_t brs, bcs;
+    int act, fast;
+    float *dm;          // sigmoid/tanh derivative, row stride ldm floats
+    uint32_t *bits;     // ReLU mask, row stride ldm words
+    size_t ldm;
+} XnnEpilogue;
+
+static void activate(Matrix *m, int act, int fast);
+static float dact_sigmoid(float a);
+static float dact_tanh(float a);
+static float dact_relu(float a);
+
+static void xnn_epilogue(const XnnEpilogue *ep, float *c, size_t ldc, size_t i0, size_t j0, size_t m, size_t n)
+{
+    int act = ep->act == ACT_SOFTMAX ? -1 : ep->act;
+    if (n == 1 && ldc == 1 && !ep->dm && !ep->bits) {   /* column vector: one contiguous run */
+        if (ep->bias) for (size_t i = 0; i < m; ++i) c[i] += ep->bias[(ptrdiff_t)(i0+i)*ep->brs + (ptrdiff_t)j0*ep->bcs];
+        Matrix v = { m, 1, c };
+        if (act >= 0) activate(&v, act, ep->fast);
+        return;
+    }
+    for (size_t i = 0; i < m; ++i) {
+        float *x = c + i*ldc;
+        const float *b = ep->bias ? ep->bias + (ptrdiff_t)(i0+i)*ep->brs + (ptrdiff_t)j0*ep->bcs : NULL;
+        if (b && ep->bcs == 1) xk()->add(x, b, n);
+        else if (b) for (size_t j = 0; j < n; ++j) x[j] += b[(ptrdiff_t)j*ep->bcs];
+        Matrix v = { 1, n, x };
+        if (act >= 0) activate(&v, act, ep->fast);
+        if (ep->bits && act == ACT_RELU) {
+            uint32_t *w = ep->bits + (i0+i)*ep->ldm;
+            for (size_t j = 0; j < n; ++j) {
+                uint32_t bit = 1u << ((j0+j) & 31);
+                if (dact_relu(x[j]) != 0) w[(j0+j) >> 5] |= bit; else w[(j0+j) >> 5] &= ~bit;
+            }
+        }
+        if (ep->dm && (act == ACT_SIGMOID || act == ACT_TANH)) {
+            float *d = ep->dm + (i0+i)*ep->ldm + j0;
+            if (act == ACT_SIGMOID) for (size_t j = 0; j < n; ++j) d[j] = dact_sigmoid(x[j]);
+            else                    for (size_t j = 0; j < n; ++j) d[j] = dact_tanh(x[j]);
+        }
+    }
+}
+
+/* B is stored as prec (weights in mixed precision); A and C are fp32. */
+static int xnn_gemm_ep(size_t M, size_t N, size_t K, float alpha,
+                       const float *A, ptrdiff_t rsa, ptrdiff_t csa,
+                       const void *B, int prec, ptrdiff_t rsb, ptrdiff_t csb,
+                       float beta, float *C, size_t ldc, const XnnEpilogue *ep)
+{
+    if (!M || !N) return 0;
+    if (!K || alpha == 0.0f) {
+        for (size_t i = 0; i < M; ++i)
+            for (size_t j = 0; j < N; ++j)
+                C[i*ldc+j] = beta == 0.0f ? 0.0f : beta*C[i*ldc+j];
+        if (ep) xnn_epilogue(ep, C, ldc, 0, 0, M, N);
+        return 0;
+    }
+    if (N == 1) {
+        const float *x = (const float*)B;
+        if (prec != PREC_FP32) {
+            float *t = xnn_pack_buf(K);
+            if (!t) return -1;
+            xnn_h2f(t, (const uint16_t*)B, rsb, K, prec);
+            x = t; rsb = 1;
+        }
+        xnn_gemv(M, K, alpha, A, PREC_FP32, rsa, csa, x, rsb, beta, C, ldc);
+        if (ep) xnn_epilogue(ep, C, ldc, 0, 0, M, N);
+        return 0;
+    }
+    if (M == 1) {   /* row vector: C^T = op(B)^T A^T, no packing */
+        xnn_gemv(N, K, alpha, B, prec, csb, rsb, A, csa, beta, C, 1);
+        if (ep) xnn_epilogue(ep, C, ldc, 0, 0, M, N);
+        return 0;
+    }
+    if (M*N*K < XNN_GEMM_SMALL) {
+        for (size_t i = 0; i < M; ++i)
+            for (size_t j = 0; j < N; ++j) {
+                float s = 0.0f;
+                for (size_t k = 0; k < K; ++k)
+                    s += A[(ptrdiff_t)i*rsa + (ptrdiff_t)k*csa] * xnn_ld(B, (ptrdiff_t)k*rsb + (ptrdiff_t)j*csb, prec);
+                C[i*ldc+j] = alpha*s + (beta == 0.0f ? 0.0f : beta*C[i*ldc+j]);
+            }
+        if (ep) xnn_epilogue(ep, C, ldc, 0, 0, M, N);
+        return 0;
+    }
+
+    const XnnKernels *ker = xk();
+    size_t MR = ker->mr, NR = ker->nr;
+    size_t nc_max = N < XNN_NC ? N : XNN_NC, kc_max = K < XNN_KC ? K : XNN_KC;
+    size_t bsz = ((nc_max + NR-1)/NR)*NR * kc_max;
+    float *pb = xnn_pack_buf(bsz + XNN_MC*kc_max);
+    if (!pb) return -1;   /* C untouched */
+    float *pa = pb + bsz;
+    float tile[XNN_MR_MAX*XNN_NR_MAX];
+
+    for (size_t jc = 0; jc < N; jc += XNN_NC) {
+        size_t nc = N-jc < XNN_NC ? N-jc : XNN_NC;
+        for (size_t pc = 0; pc < K; pc += XNN_KC) {
+            size_t kc = K-pc < XNN_KC ? K-pc : XNN_KC;
+            float bt = pc ? 1.0f : beta;
+            ptrdiff_t off = (ptrdiff_t)pc*rsb + (ptrdiff_t)jc*csb;
+            xnn_pack_b(kc, nc, NR, prec == PREC_FP32 ? (const void*)((const float*)B + off)
+                                                     : (const void*)((const uint16_t*)B + off), prec, rsb, csb, pb);
+            for (size_t ic = 0; ic < M; ic += XNN_MC) {
+                size_t mc = M-ic < XNN_MC ? M-ic : XNN_MC;
+                xnn_pack_a(mc, kc, MR, A + (ptrdiff_t)ic*rsa + (ptrdiff_t)pc*csa, rsa, csa, pa);
+                for (size_t jr = 0; jr < nc; jr += NR) {
+                    size_t nr = nc-jr < NR ? nc-jr : NR;
+                    for (size_t ir = 0; ir < mc; ir += MR) {
+                        size_t mr = mc-ir < MR ? mc-ir : MR;
+                        float *c = C + (ic+ir)*ldc + jc+jr;
+                        if (mr == MR && nr == NR) {
+                            ker->gemm_kernel(kc, pa + ir*kc, pb + jr*kc, c, ldc, alpha, bt);
+                        } else {
+                            ker->gemm_kernel(kc, pa + ir*kc, pb + jr*kc, tile, NR, alpha, 0.0f);
+                            for (size_t i = 0; i < mr; ++i)
+                                for (size_t j = 0; j < nr; ++j)
+                                    c[i*ldc+j] = tile[i*NR+j] + (bt == 0.0f ? 0.0f : bt*c[i*ldc+j]);
+                        }
+                        if (ep && pc + kc == K) xnn_epilogue(ep, c, ldc, ic+ir, jc+jr, mr, nr);
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static int xnn_gemm(size_t M, size_t N, size_t K, float alpha,
+                    const float *A, ptrdiff_t rsa, ptrdiff_t csa,
+                    const float *B, ptrdiff_t rsb, ptrdiff_t csb,
+                    float beta, float *C, size_t ldc)
+{ return xnn_gemm_ep(M, N, K, alpha, A, rsa, csa, B, PREC_FP32, rsb, csb, beta, C, ldc, NULL); }
+
+int matrix_gemm(Matrix *dst, const Matrix *a, const Matrix *b, int ta, int tb, float alpha, float beta)
+{
+    if (!dst || !a || !b) return -1;
+    size_t M = ta ? a->cols : a->rows, K = ta ? a->rows : a->cols;
+    size_t kb = tb ? b->cols : b->rows, N = tb ? b->rows : b->cols;
+    if (K != kb || dst->rows != M || dst->cols != N) return -1;
+    return xnn_gemm(M, N, K, alpha,
+                    a->data, ta ? 1 : (ptrdiff_t)a->cols, ta ? (ptrdiff_t)a->cols : 1,
+                    b->data, tb ? 1 : (ptrdiff_t)b->cols, tb ? (ptrdiff_t)b->cols : 1,
+                    beta, dst->data, dst->cols);
+}
+
+/* ---------- Sparse ----------
+ * Pruned weights as block-CSR over output rows: block row r covers rows
+ * r*B..r*B+B-1, and each stored block is the B weights of one input column
+ * (B = 1 is plain CSR; 4x1 and 8x1 fill one SSE/AVX register per FMA).
+ * The last block row is zero-padded. y = W x walks only the stored blocks;
+ * the epilogue then adds bias and activation as for the dense GEMM. */
+#define XNN_SPARSE_CSR 0.25f   // max density at which each format beat the dense
+#define XNN_SPARSE_B4  0.50f   // GEMV on a 1024-2048-2048 MLP
+#define XNN_SPARSE_B8  0.60f
+#define XNN_SPARSE_ROWS 8      // bigger batches amortize the packed GEMM and stay dense
+
+struct XnnSparse {
+    size_t block, rows, cols;
+    uint32_t *ptr;     // (rows+B-1)/B + 1 offsets into col/val
+    uint32_t *col;     // input column of each block
+    float *val;        // B weights per block
+};
+
+static void xnn_sparse_free(XnnSparse *sp)
+{
+    if (!sp) return;
+    free(sp->ptr); free(sp->col); xnn_free(sp->val);
+    free(sp);
+}
+
+static XnnSparse *xnn_sparse_build(const Matrix *w, size_t block)
+{
+    size_t n = w->rows, k = w->cols, nb = (n + block-1)/block, nnz = 0;
+    for (size_t r = 0; r < nb; ++r)
+        for (size_t c = 0; c < k; ++c)
+            for (size_t i = r*block; i < n && i < (r+1)*block; ++i)
+                if (w->data[i*k+c] != 0.0f) { ++nnz; break; }
+    XnnSparse *sp = calloc(1, sizeof *sp);
+    if (!sp) return NULL;
+    sp->block = block; sp->rows = n; sp->cols = k;
+    sp->ptr = malloc((nb+1)*sizeof(uint32_t));
+    sp->col = malloc((nnz ? nnz : 1)*sizeof(uint32_t));
+    sp->val = xnn_alloc((nnz ? nnz : 1)*block*sizeof(float));
+    if (!sp->ptr || !sp->col || !sp->val) { xnn_sparse_free(sp); return NULL; }
+    memset(sp->val, 0, (nnz ? nnz : 1)*block*sizeof(float));
+    nnz = 0;
+    for (size_t r = 0; r < nb; ++r) {
+        sp->ptr[r] = (uint32_t)nnz;
+        for (size_t c = 0; c < k; ++c) {
+            int any = 0;
+            for (size_t i = r*block; i < n && i < (r+1)*block; ++i) any |= w->data[i*k+c] != 0.0f;
+            if (!any) continue;
+            for (size_t i = r*block; i < n && i < (r+1)*block; ++i) sp->val[nnz*block + i - r*block] = w->data[i*k+c];
+            sp->col[nnz++] = (uint32_t)c;
+        }
+    }
+    sp->ptr[nb] = (uint32_t)nnz;
+    return sp;
+}
+
+/* Y = X W^T for `rows` rows of X (row stride ldx) into Y (row stride ldy) */
+static void xnn_sparse_ep(const XnnSparse *sp, size_t rows, const float *x, size_t ldx,
+                          float *y, size_t ldy, const XnnEpilogue *ep)
+{
+    const XnnKernels *k = xk();
+    size_t B = sp->block, full = sp->rows / B, idx = B == 1 ? 0 : B == 4 ? 1 : 2;
+    for (size_t r = 0; r < rows; ++r) {
+        float *yr = y + r*ldy;
+        const float *xr = x + r*ldx;
+        k->spmv[idx](yr, sp->ptr, sp->col, sp->val, full, xr);
+        if (full*B < sp->rows) {
+            float t[8];
+            k->spmv[idx](t, sp->ptr + full, sp->col, sp->val, 1, xr);
+            memcpy(yr + full*B, t, (sp->rows - full*B)*sizeof(float));
+        }
+    }
+    if (ep) xnn_epilogue(ep, y, ldy, 0, 0, rows, sp->rows);
+}
+
+/* ---------- Activations ----------
+ * dact_* take the stored activation a = f(z), not z. */
+static void act_sigmoid(Matrix *m)
+{ for(size_t i=0;i<m->rows*m->cols;i++) m->data[i]=1/(1+expf(-m->data[i])); }
+static float dact_sigmoid(float a) { return a*(1-a); }
+static void act_tanh(Matrix *m)
+{ for(size_t i=0;i<m->rows*m->cols;i++) m->data[i]=tanhf(m->data[i]); }
+static float dact_tanh(float a) { return 1-a*a; }
+static void act_relu(Matrix *m)
+{ xk()->relu(m->data, m->rows*m->cols); }
+static float dact_relu(float a) { return a>0?1:0; }
+/* returns log(sum e^x), the cross-entropy's normalizer */
+static float softmax(float *x, size_t n, int fast)
+{
+    float max = x[0], sum = 0.0f;
+    for (size_t i = 1; i < n; ++i) if (x[i] > max) max = x[i];
+    if (fast) sum = xk()->expsum(x, max, n);
+    else for (size_t i = 0; i < n; ++i) { x[i] = expf(x[i] - max); sum += x[i]; }
+    xk()->scale(x, 1.0f / sum, n);
+    return max + logf(sum);
+}
+/* a column vector is one distribution; otherwise each row is */
+static void softmax_rows(Matrix *m, int fast)
+{
+    if (m->cols == 1) { softmax(m->data, m->rows, fast); return; }
+    for (size_t r = 0; r < m->rows; ++r) softmax(m->data + r*m->cols, m->cols, fast);
+}
+static void act_softmax(Matrix *m)
+{
+    if (!m) return;
+    softmax_rows(m, 0);
+}
+static void act_linear(Matrix *m) { (void)m; /* identity */ }
+
+/* fast != 0 swaps libm for the polynomial kernels */
+static void activate(Matrix *m, int act, int fast)
+{
+    size_t n = m->rows*m->cols;
+    if (act == ACT_SIGMOID) { if (fast) xk()->sigmoid(m->data, n); else act_sigmoid(m); }
+    else if (act == ACT_TANH) { if (fast) xk()->tanh(m->data, n); else act_tanh(m); }
+    else if (act == ACT_RELU) act_relu(m);
+    else if (act == ACT_SOFTMAX) { if (fast) softmax_rows(m, 1); else act_softmax(m); }
+    else if (act == ACT_LINEAR) act_linear(m);
+}
+
+/* ---------- Threads ----------
+ * A persistent work-stealing pool. Workers are started once and park on a
+ * condition variable between jobs. xnn_parallel_for cuts [begin,end) into
+ * grain-sized chunks and hands each participant (the caller is tid 0) a
+ * contiguous run of them as its deque; the owner pops from the front, idle
+ * threads steal the back half of someone else's. A deque is a packed
+ * (lo, hi) chunk range updated by CAS, so there are no locks on the hot path.
+ * Single chunk, one thread, a busy pool or a nested call: fn runs inline. */
+typedef struct { uint64_t range; char pad[56]; } XnnDeque;   // one per cache line
+
+static struct {
+    pthread_mutex_t run;   // held by the thread currently dispatching
+    pthread_mutex_t mu;
+    pthread_cond_t start, done;
+    pthread_t *th;
+    XnnDeque *dq;
+    size_t started;        // workers running (tids 1..started)
+    size_t threads;        // xnn_set_threads; 0 = not configured yet; atomic, may change mid-run
+    unsigned long gen;
+    xnn_range_fn fn;
+    void *ctx;
+    size_t begin, end, grain, n, pending;
+} xnn_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+               PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+               NULL, NULL, 0, 0, 0, NULL, NULL, 0, 0, 0, 0, 0 };
+
+#define XNN_RANGE(lo, hi) (((uint64_t)(lo) << 32) | (uint64_t)(hi))
+
+static void xnn_pool_work(size_t self)
+{
+    XnnDeque *dq = xnn_pool.dq;
+    size_t n = xnn_pool.n;
+    for (;;) {
+        uint64_t r = __atomic_load_n(&dq[self].range, __ATOMIC_ACQUIRE);
+        while ((uint32_t)(r >> 32) < (uint32_t)r) {
+            size_t c = r >> 32;
+            if (!__atomic_compare_exchange_n(&dq[self].range, &r, XNN_RANGE(c+1, (uint32_t)r), 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) continue;
+            size_t b = xnn_pool.begin + c*xnn_pool.grain;
+            xnn_pool.fn(xnn_pool.ctx, b, xnn_pool.end - b < xnn_pool.grain ? xnn_pool.end : b + xnn_pool.grain);
+            r = __atomic_load_n(&dq[self].range, __ATOMIC_ACQUIRE);
+        }
+        int stole = 0;
+        for (size_t k = 1; k < n && !stole; ++k) {
+            XnnDeque *v = &dq[(self + k) % n];
+            r = __atomic_load_n(&v->range, __ATOMIC_ACQUIRE);
+            while (!stole && (uint32_t)(r >> 32) < (uint32_t)r) {
+                uint32_t lo = r >> 32, hi = (uint32_t)r, mid = lo + (hi - lo)/2;
+                if (__atomic_compare_exchange_n(&v->range, &r, XNN_RANGE(lo, mid), 0,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    __atomic_store_n(&dq[self].range, XNN_RANGE(mid, hi), __ATOMIC_RELEASE);
+                    stole = 1;
+                }
+            }
+        }
+        if (!stole) return;
+    }
+}
+
+static void *xnn_worker(void *arg)
+{
+    size_t tid = (size_t)arg;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&xnn_pool.mu);
+    for (;;) {
+        while (xnn_pool.gen == seen) pthread_cond_wait(&xnn_pool.start, &xnn_pool.mu);
+        seen = xnn_pool.gen;
+        if (tid >= xnn_pool.n) continue;
+        pthread_mutex_unlock(&xnn_pool.mu);
+        xnn_pool_work(tid);
+        pthread_mutex_lock(&xnn_pool.mu);
+        if (--xnn_pool.pending == 0) pthread_cond_signal(&xnn_pool.done);
+    }
+    return NULL;
+}
+
+int xnn_set_threads(int n)
+{
+    if (n <= 0) {
+        const char *env = getenv("XNN_THREADS");
+        n = env ? atoi(env) : 0;
+        if (n <= 0) n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (n <= 0) n = 1;
+    }
+    __atomic_store_n(&xnn_pool.threads, (size_t)n, __ATOMIC_RELAXED);
+    return n;
+}
+int xnn_get_threads(void)
+{
+    size_t n = __atomic_load_n(&xnn_pool.threads, __ATOMIC_RELAXED);
+    return n ? (int)n : xnn_set_threads(0);
+}
+
+/* Grow to n participants; called with run and mu held. Returns how many we have. */
+static size_t xnn_pool_grow(size_t n)
+{
+    if (xnn_pool.started >= n-1) return n;
+    XnnDeque *dq = NULL;
+    if (posix_memalign((void**)&dq, 64, n*sizeof(XnnDeque))) return xnn_pool.started + 1;
+    free(xnn_pool.dq);
+    xnn_pool.dq = dq;
+    pthread_t *th = realloc(xnn_pool.th, (n-1)*sizeof(pthread_t));
+    if (!th) return xnn_pool.started + 1;
+    xnn_pool.th = th;
+    while (xnn_pool.started < n-1 &&
+           !pthread_create(&th[xnn_pool.started], NULL, xnn_worker, (void*)(xnn_pool.started+1)))
+        pthread_detach(th[xnn_pool.started++]);
+    return xnn_pool.started + 1;
+}
+
+void xnn_parallel_for(size_t begin, size_t end, size_t grain, xnn_range_fn fn, void *ctx)
+{
+    if (!fn || begin >= end) return;
+    if (!grain) grain = 1;
+    size_t chunks = (end - begin + grain - 1) / grain;
+    size_t n = (size_t)xnn_get_threads();
+    if (n > chunks) n = chunks;
+    if (chunks > UINT32_MAX || n < 2 || pthread_mutex_trylock(&xnn_pool.run)) {
+        fn(ctx, begin, end);
+        return;
+    }
+    pthread_mutex_lock(&xnn_pool.mu);
+    n = xnn_pool_grow(n);
+    if (n < 2) {
+        pthread_mutex_unlock(&xnn_pool.mu);
+        pthread_mutex_unlock(&xnn_pool.run);
+        fn(ctx, begin, end);
+        return;
+    }
+    for (size_t t = 0; t < n; ++t)
+        xnn_pool.dq[t].range = XNN_RANGE(t*chunks/n, (t+1)*chunks/n);
+    xnn_pool.fn = fn; xnn_pool.ctx = ctx;
+    xnn_pool.begin = begin; xnn_pool.end = end; xnn_pool.grain = grain;
+    xnn_pool.n = n;
+    xnn_pool.pending = n-1;
+    xnn_pool.gen++;
+    pthread_cond_broadcast(&xnn_pool.start);
+    pthread_mutex_unlock(&xnn_pool.mu);
+    xnn_pool_work(0);
+    pthread_mutex_lock(&xnn_pool.mu);
+    while (xnn_pool.pending) pthread_cond_wait(&xnn_pool.done, &xnn_pool.mu);
+    pthread_mutex_unlock(&xnn_pool.mu);
+    pthread_mutex_unlock(&xnn_pool.run);
+}
+
+/* ---------- Network ---------- */
+/* The sparse copies are snapshots of w; anything that rewrites w drops them. */
+static void network_drop_sparse(Network *net)
+{
+    if (!net->sp) return;
+    for (size_t i = 0; i < net->layers-1; ++i) xnn_sparse_free(net->sp[i]);
+    free(net->sp);
+    net->sp = NULL;
+}
+/* Everything but the weight values; network_alloc randomizes them,
+ * clone/load overwrite them. */
+static Network *network_make(const size_t *arch, size_t n, const int *act, int loss)
+{
+    if(!arch||n<2||!act) return NULL;
+    Network *net = calloc(1, sizeof*net);
+    if(!net) return NULL;
+    net->layers = n;
+    net->loss = loss;
+    net->prec = PREC_FP32;
+    net->grad_sq = -1.0f;
+    for(size_t i=1;i<n;i++) net->nparams += arch[i]*arch[i-1] + arch[i];
+    net->activations = malloc(sizeof(int)*n);
+    if(!net->activations) { free(net); return NULL; }
+    memcpy(net->activations, act, sizeof(int)*n);
+    net->w = calloc(n-1, sizeof(Matrix*));
+    net->b = calloc(n-1, sizeof(Matrix*));
+    net->a = calloc(n, sizeof(Matrix*));
+    net->views = malloc(2*(n-1)*sizeof(Matrix));
+    if(!net->w||!net->b||!net->a||!net->views) goto fail;
+    if(!(net->params = xnn_alloc(net->nparams*sizeof(float)))) goto fail;
+    net->a[0] = matrix_alloc(arch[0],1);
+    if(!net->a[0]) goto fail;
+    for(size_t i=1, off=0;i<n;i++){
+        Matrix *w = &net->views[2*(i-1)], *b = w + 1;
+        if(!arch[i]) goto fail;
+        w->rows = arch[i]; w->cols = arch[i-1]; w->data = net->params + off; off += arch[i]*arch[i-1];
+        b->rows = arch[i]; b->cols = 1;         b->data = net->params + off; off += arch[i];
+        net->w[i-1] = w;
+        net->b[i-1] = b;
+        net->a[i] = matrix_alloc(arch[i],1);
+        if(!net->a[i]) goto fail;
+    }
+    return net;
+fail:
+    network_free(net);
+    return NULL;
+}
+Network *network_alloc(const size_t *arch, size_t n, const int *act, int loss)
+{
+    Network *net = network_make(arch, n, act, loss);
+    if(net) network_rand(net);
+    return net;
+}
+void network_free(Network *net)
+{
+    if(!net) return;
+    if(net->activations) free(net->activations);
+    if(net->a){ for(size_t i=0;i<net->layers;i++) matrix_free(net->a[i]); free(net->a); }
+    free(net->w); free(net->b); free(net->views); xnn_free(net->params);
+    if(net->ab){ for(size_t i=0;i<net->layers;i++) xnn_free(net->ab[i]); free(net->ab); }
+    if(net->dm){ for(size_t i=0;i<net->layers;i++) xnn_free(net->dm[i]); free(net->dm); }
+    if(net->wh){ for(size_t i=0;i<net->layers-1;i++) xnn_free(net->wh[i]); free(net->wh); }
+    network_drop_sparse(net);
+    xnn_free(net->shards);
+    free(net);
+}
+/* Re-round the half copies after the fp32 masters changed. */
+static void network_sync_half(Network *net)
+{
+    if (!net->wh) return;
+    for (size_t i = 0; i < net->layers-1; ++i)
+        xk()->f2h[net->prec-1](net->wh[i], net->w[i]->data, net->w[i]->rows*net->w[i]->cols);
+}
+void network_rand(Network *net)
+{
+    if(!net) return;
+    for(size_t i=0;i<net->layers-1;i++){
+        Matrix *w = net->w[i];
+        size_t fan_in = w->cols, fan_out = w->rows;
+        float limit;
+        int act_type = net->activations[i+1];
+        if (act_type == ACT_RELU || act_type == ACT_LINEAR) {
+            limit = sqrtf(2.0f / fan_in);
+        } else {
+            limit = sqrtf(6.0f / (fan_in + fan_out));
+        }
+        for(size_t j=0;j<w->rows*w->cols;j++)
+            w->data[j] = rand_float(-limit, limit);
+        if(net->b[i]) matrix_rand_bias(net->b[i]);
+    }
+    net->grad_sq = -1.0f;
+    network_drop_sparse(net);
+    network_sync_half(net);
+}
+void network_zero(Network *net)
+{
+    if(!net) return;
+    memset(net->params, 0, net->nparams*sizeof(float));
+    net->grad_sq = 0.0f;
+    network_drop_sparse(net);
+}
+float *network_params(Network *net, size_t *n)
+{
+    if(!net) return NULL;
+    if(n) *n = net->nparams;
+    net->grad_sq = -1.0f;   /* caller may write through it: norm unknown */
+    return net->params;
+}
+float network_norm(const Network *net)
+{ return net ? sqrtf(xk()->sumsq(net->params, net->nparams)) : 0.0f; }
+
+/* Same architecture: parameters in one memcpy, settings follow. */
+int network_copy(Network *dst, const Network *src)
+{
+    if (!dst || !src || dst->layers != src->layers || dst->nparams != src->nparams) return -1;
+    for (size_t i = 0; i < src->layers; ++i)
+        if (dst->a[i]->rows != src->a[i]->rows || dst->activations[i] != src->activations[i]) return -1;
+    memcpy(dst->params, src->params, src->nparams*sizeof(float));
+    dst->grad_sq = src->grad_sq;
+    dst->loss = src->loss;
+    dst->fast = src->fast;
+    network_drop_sparse(dst);
+    if (dst->prec == src->prec) { network_sync_half(dst); return 0; }
+    return network_set_precision(dst, src->prec);
+}
+Network *network_clone(const Network *src)
+{
+    if (!src) return NULL;
+    size_t *arch = malloc(src->layers*sizeof(size_t));
+    if (!arch) return NULL;
+    for (size_t i = 0; i < src->layers; ++i) arch[i] = src->a[i]->rows;
+    Network *net = network_make(arch, src->layers, src->activations, src->loss);
+    free(arch);
+    if (net && network_copy(net, src)) { network_free(net); return NULL; }
+    return net;
+}
+void network_set_fast_math(Network *net, int on)
+{ if(net) net->fast = on ? 1 : 0; }
+
+int network_set_precision(Network *net, int prec)
+{
+    if (!net || prec < PREC_FP32 || prec > PREC_FP16) return -1;
+    if (prec != PREC_FP32 && !net->wh) {
+        if (!(net->wh = calloc(net->layers-1, sizeof(uint16_t*)))) return -1;
+        for (size_t i = 0; i < net->layers-1; ++i)
+            if (!(net->wh[i] = xnn_alloc(net->w[i]->rows*net->w[i]->cols*sizeof(uint16_t)))) prec = -1;
+    }
+    if (prec <= PREC_FP32) {
+        if (net->wh) { for (size_t i = 0; i < net->layers-1; ++i) xnn_free(net->wh[i]); free(net->wh); }
+        net->wh = NULL;
+        net->prec = PREC_FP32;
+        return prec == PREC_FP32 ? 0 : -1;
+    }
+    net->prec = prec;
+    network_sync_half(net);
+    return 0;
+}
+static int cmp_float(const void *a, const void *b)
+{ float x = *(const float*)a, y = *(const float*)b; return (x > y) - (x < y); }
+
+/* Zero the `sparsity` fraction of Bx1 weight blocks with the least energy
+ * in each layer, then give every layer whose measured block density is low
+ * enough for the sparse kernels to win a sparse copy for inference. */
+int network_prune(Network *net, float sparsity, int block)
+{
+    if (!net || !(sparsity >= 0.0f && sparsity < 1.0f) || (block != 1 && block != 4 && block != 8)) return -1;
+    static const float max_density[3] = { XNN_SPARSE_CSR, XNN_SPARSE_B4, XNN_SPARSE_B8 };
+    size_t B = (size_t)block;
+    network_drop_sparse(net);
+    if (!(net->sp = calloc(net->layers-1, sizeof(XnnSparse*)))) return -1;
+    int rc = 0;
+    for (size_t l = 0; l < net->layers-1 && !rc; ++l) {
+        Matrix *w = net->w[l];
+        size_t n = w->rows, k = w->cols, nb = (n + B-1)/B, total = nb*k, drop = (size_t)(sparsity*total), live = 0;
+        float *e = malloc(2*total*sizeof(float));
+        if (!e) { rc = -1; break; }
+        for (size_t r = 0; r < nb; ++r)
+            for (size_t c = 0; c < k; ++c) {
+                float s = 0.0f;
+                for (size_t i = r*B; i < n && i < (r+1)*B; ++i) s += w->data[i*k+c]*w->data[i*k+c];
+                e[r*k+c] = s;
+            }
+        if (drop) {
+            memcpy(e + total, e, total*sizeof(float));
+            qsort(e + total, total, sizeof(float), cmp_float);
+            float thr = e[total + drop-1];
+            for (size_t j = 0; j < total; ++j)   // below thr first, then ties up to `drop`
+                if (e[j] < thr) { e[j] = 0.0f; --drop; }
+            for (size_t j = 0; j < total && drop; ++j)
+                if (e[j] == thr) { e[j] = 0.0f; --drop; }
+            for (size_t r = 0; r < nb; ++r)
+                for (size_t c = 0; c < k; ++c)
+                    if (e[r*k+c] == 0.0f)
+                        for (size_t i = r*B; i < n && i < (r+1)*B; ++i) w->data[i*k+c] = 0.0f;
+        }
+        for (size_t j = 0; j < total; ++j) live += e[j] != 0.0f;
+        free(e);
+        if (live <= max_density[B/4]*total && !(net->sp[l] = xnn_sparse_build(w, B))) rc = -1;
+    }
+    if (rc) network_drop_sparse(net);   /* out of memory: no layer keeps a sparse copy */
+    network_sync_half(net);
+    return rc;
+}
+/* the weights the GEMMs read: fp32 masters or their half copies */
+static const void *network_wt(const Network *net, size_t l)
+{ return net->prec == PREC_FP32 ? (const void*)net->w[l]->data : (const void*)net->wh[l]; }
+void network_print(const Network *net)
+{
+    if (!net) return;
+    printf("Network: %zu layers, loss=%s\n", net->layers,
+           net->loss == LOSS_MSE ? "MSE" : "Cross-Entropy");
+    for (size_t i = 0; i < net->layers - 1; ++i) {
+        const char* act_str = 
+            net->activations[i+1] == ACT_SIGMOID ? "Sigmoid" :
+            net->activations[i+1] == ACT_TANH ? "Tanh" :
+            net->activations[i+1] == ACT_RELU ? "ReLU" :
+            net->activations[i+1] == ACT_SOFTMAX ? "Softmax" :
+            net->activations[i+1] == ACT_LINEAR ? "Linear" : "Unknown";
+        printf("Layer %zu -> %zu: %s\n", i, i+1, act_str);
+        printf(" W: "); matrix_print(net->w[i]);
+        printf(" b: "); matrix_print(net->b[i]);
+    }
+}
+void forward(Network *net)
+{
+    if(!net) return;
+    for(size_t i=0;i<net->layers-1;i++){
+        const Matrix *w = net->w[i];
+        XnnEpilogue ep = { net->b[i]->data, 0, 1, net->activations[i+1], net->fast, NULL, NULL, 0 };
+        if (net->sp && net->sp[i])
+            xnn_sparse_ep(net->sp[i], 1, net->a[i]->data, w->cols, net->a[i+1]->data, w->rows, &ep);
+        else
+            xnn_gemm_ep(1, w->rows, w->cols, 1.0f, net->a[i]->data, w->cols, 1,
+                        network_wt(net, i), net->prec, 1, w->cols, 0.0f, net->a[i+1]->data, w->rows, &ep);
+        if (net->activations[i+1] == ACT_SOFTMAX) softmax_rows(net->a[i+1], net->fast);
+    }
+}
+/* Grow the batch activation buffers to hold at least `rows` rows. */
+/* masks != 0 also sizes the derivative buffers for backprop, stage != 0
+ * the ab[0] buffer gathered input views are read through. */
+static int network_reserve(Network *net, size_t rows, int masks, int stage)
+{
+    if (rows <= net->ab_cap && (!masks || net->dm) && (!stage || net->ab[0])) return 0;
+    if (rows < net->ab_cap) rows = net->ab_cap;
+    if (!net->ab && !(net->ab = calloc(net->layers, sizeof(float*)))) return -1;
+    if (masks && !net->dm && !(net->dm = calloc(net->layers, sizeof(float*)))) return -1;
+    if ((stage || net->ab[0]) && (rows > net->ab_cap || !net->ab[0])) {
+        xnn_free(net->ab[0]);
+        if (!(net->ab[0] = xnn_alloc(rows*net->a[0]->rows*sizeof(float)))) { net->ab_cap = 0; return -1; }
+    }
+    for (size_t l = 1; l < net->layers; ++l) {
+        if (rows > net->ab_cap) {
+            xnn_free(net->ab[l]);
+            if (!(net->ab[l] = xnn_alloc(rows*net->a[l]->rows*sizeof(float)))) { net->ab_cap = 0; return -1; }
+        }
+        if (net->dm) {
+            xnn_free(net->dm[l]);
+            if (!(net->dm[l] = xnn_alloc(rows*net->a[l]->rows*sizeof(float)))) { net->ab_cap = 0; return -1; }
+        }
+    }
+    net->ab_cap = rows;
+    return 0;
+}
+
+/* derivative buffer row stride: words for the ReLU bitmask, floats otherwise */
+static size_t dm_ld(int act, size_t n) { return act == ACT_RELU ? (n + 31)/32 : n; }
+
+/* The first layer's input rows r0..r1: strided views go to the GEMM as
+ * they are; gathered and u8 ones are collected into the stage buffer
+ * first, bytes scaled on the way. */
+static int tensor_staged(const Tensor *x) { return x->index || x->u8; }
+static const float *input_rows(const Tensor *x, float *stage, size_t r0, size_t r1, ptrdiff_t *rs, ptrdiff_t *cs)
+{
+    if (!tensor_staged(x)) { *rs = x->stride[0]; *cs = x->stride[1]; return tensor_row(x, r0); }
+    size_t n = x->shape[1];
+    for (size_t r = r0; r < r1; ++r) tensor_copy_row(x, r, stage + r*n);
+    *rs = (ptrdiff_t)n; *cs = 1;
+    return stage + r0*n;
+}
+
+/* Row-major mini-batch: each layer is one GEMM A_l = f(A_{l-1} W^T + b)
+ * with bias and activation fused into the tile epilogue, written to act[l]
+ * (act[0] stages gathered inputs); dm != NULL also records f'(z) there.
+ * logits leaves a softmax output layer as z, for the fused loss.
+ * Works on rows r0..r1 of x (a 2-D view, see tensor_flat2) and of the
+ * buffers, so shards can run side by side. Only reads net. -1 when a GEMM
+ * can't get its pack buffer. */
+static int forward_rows(const Network *net, const Tensor *x, size_t r0, size_t r1, float *const *act_buf,
+                         float *const *dm, int logits)
+{
+    ptrdiff_t rs, cs;
+    const float *prev = input_rows(x, act_buf[0], r0, r1, &rs, &cs);
+    size_t rows = r1 - r0;
+    for (size_t l = 1; l < net->layers; ++l) {
+        const Matrix *w = net->w[l-1];
+        int act = net->activations[l];
+        size_t ld = dm_ld(act, w->rows);
+        float *h = act_buf[l] + r0*w->rows;
+        XnnEpilogue ep = { net->b[l-1]->data, 0, 1, act, net->fast, NULL, NULL, ld };
+        if (dm && act == ACT_RELU) ep.bits = (uint32_t*)dm[l] + r0*ld;
+        if (dm && (act == ACT_SIGMOID || act == ACT_TANH)) ep.dm = dm[l] + r0*ld;
+        if (net->sp && net->sp[l-1] && rows <= XNN_SPARSE_ROWS && cs == 1)
+            xnn_sparse_ep(net->sp[l-1], rows, prev, (size_t)rs, h, w->rows, &ep);
+        else if (xnn_gemm_ep(rows, w->rows, w->cols, 1.0f, prev, rs, cs,
+                             network_wt(net, l-1), net->prec, 1, w->cols, 0.0f, h, w->rows, &ep))
+            return -1;
+        if (act == ACT_SOFTMAX && !(logits && l == net->layers-1))
+            for (size_t r = 0; r < rows; ++r) softmax(h + r*w->rows, w->rows, net->fast);
+        prev = h; rs = (ptrdiff_t)w->rows; cs = 1;
+    }
+    return 0;
+}
+Matrix *forward_view(Network *net, const Tensor *x)
+{
+    Tensor v;
+    if (!net || tensor_flat2(x, net->a[0]->rows, &v) || network_reserve(net, v.shape[0], 0, tensor_staged(&v)) ||
+        forward_rows(net, &v, 0, v.shape[0], net->ab, NULL, 0)) return NULL;
+    net->out.rows = v.shape[0];
+    net->out.cols = net->a[net->layers-1]->rows;
+    net->out.data = net->ab[net->layers-1];
+    return &net->out;
+}
+Matrix *forward_batch(Network *net, const Matrix *x)
+{
+    if (!x) return NULL;
+    Tensor v = matrix_view(x);
+    return forward_view(net, &v);
+}
+
+/* d *= f'(z) for rows r0.. of layer l, from the masks forward_rows stored */
+static void dmask_mul(const Network *net, size_t l, float *d, size_t r0, size_t rows)
+{
+    int act = net->activations[l];
+    size_t n = net->a[l]->rows, ld = dm_ld(act, n);
+    if (act == ACT_RELU) {
+        const uint32_t *bits = (const uint32_t*)net->dm[l] + r0*ld;
+        for (size_t r = 0; r < rows; ++r, bits += ld, d += n)
+            for (size_t j = 0; j < n; ++j)
+                if (!(bits[j >> 5] >> (j & 31) & 1)) d[j] = 0.0f;
+    } else if (act == ACT_SIGMOID || act == ACT_TANH) {
+        const float *m = net->dm[l] + r0*ld;
+        for (size_t i = 0; i < rows*n; ++i) d[i] *= m[i];
+    } else if (act != ACT_LINEAR) xk()->fill(d, 0.0f, rows*n);
+}
+
+/* Data-parallel backprop: the batch is cut into T row shards, one per
+ * thread, each with its own gradient accumulator. Shard 0 writes straight
+ * into grad->params, shards 1..T-1 into grad->shards laid out the same way
+ * (stride padded to 64 bytes). A pairwise tree then folds shard s+step into
+ * shard s for step = 1, 2, 4, ... The squared norm grad_sq is taken as the
+ * final values come out, still in cache: per layer in a lone shard, else
+ * per chunk of the last tree level (partials after the shards, summed in
+ * a fixed order). */
+#define XNN_SHARD_ROWS 8        /* fewest rows worth a thread */
+#define XNN_REDUCE_CHUNK 4096   /* floats per reduction work item */
+
+typedef struct {
+    Network *net, *grad;
+    Tensor in, out;    // 2-D views
+    size_t shards, stride, step;
+    float inv;
+    float *sq;         // last tree level: |chunk|^2 per work item, else NULL
+    const uint16_t *labels;   // class ids instead of out, indexed like in's rows before gathering
+    float *loss;       // summed loss per shard
+    int *err;          // set by a shard whose GEMM failed
+} XnnBackprop;
+
+static float *shard_base(const XnnBackprop *bp, size_t s)
+{ return s ? bp->grad->shards + (s-1)*bp->stride : bp->grad->params; }
+static float *grad_shard(const XnnBackprop *bp, size_t s, size_t l, int bias)
+{
+    const Network *g = bp->grad;
+    return shard_base(bp, s) + ((bias ? g->b[l]->data : g->w[l]->data) - g->params);
+}
+
+/* Output layer for rows r0..: D_L = dL/dZ_L into grad's buffer, returning
+ * the rows' summed loss. Targets are out's rows, or one-hot from labels.
+ * Softmax + CE is fused on the logits forward_rows left: with
+ * lse = log(sum e^z), loss = sum t*(lse - z) and D = p - t, so it stays
+ * finite however confident the net is; ab[L] ends up holding p. */
+static double output_rows(const XnnBackprop *bp, size_t r0, size_t rows)
+{
+    const Network *net = bp->net;
+    size_t L = net->layers-1, n = net->a[L]->rows;
+    int act = net->activations[L];
+    double loss = 0.0;
+    for (size_t r = r0; r < r0 + rows; ++r) {
+        float *y = net->ab[L] + r*n, *d = bp->grad->ab[L] + r*n;
+        const float *t = bp->labels ? NULL : tensor_row(&bp->out, r);
+        ptrdiff_t ts = bp->out.stride[1];
+        size_t lab = bp->labels ? bp->labels[bp->in.index ? bp->in.index[r] : r] : n;
+        if (net->loss == LOSS_CE && act == ACT_SOFTMAX) {
+            float tz = lab < n ? y[lab] : 0.0f, tsum = lab < n ? 1.0f : 0.0f;
+            if (t) for (size_t j = 0; j < n; ++j) { tz += t[(ptrdiff_t)j*ts]*y[j]; tsum += t[(ptrdiff_t)j*ts]; }
+            loss += tsum*softmax(y, n, net->fast) - tz;
+            for (size_t j = 0; j < n; ++j) d[j] = y[j] - (t ? t[(ptrdiff_t)j*ts] : 0.0f);
+            if (lab < n) d[lab] -= 1.0f;
+        } else if (net->loss == LOSS_CE) {
+            for (size_t j = 0; j < n; ++j) {
+                float tj = t ? t[(ptrdiff_t)j*ts] : j == lab ? 1.0f : 0.0f;
+                d[j] = y[j] - tj;
+                if (tj != 0.0f) loss -= tj*logf(y[j] > FLT_MIN ? y[j] : FLT_MIN);
+            }
+        } else {
+            for (size_t j = 0; j < n; ++j) {
+                d[j] = y[j] - (t ? t[(ptrdiff_t)j*ts] : j == lab ? 1.0f : 0.0f);
+                loss += d[j]*d[j];
+                d[j] *= 2.0f;
+            }
+        }
+    }
+    if (!(net->loss == LOSS_CE && act == ACT_SOFTMAX))
+        dmask_mul(net, L, bp->grad->ab[L] + r0*n, r0, rows);
+    return loss;
+}
+
+/* Whole-shard backward pass. With D_l = dL/dZ_l (rows x arch[l]) held in
+ * grad's batch buffers:
+ *   dW_{l-1} = D_l^T A_{l-1} / batch     (GEMM, into this shard's gradient)
+ *   db_{l-1} = colsum(D_l) / batch
+ *   D_{l-1}  = (D_l W_{l-1}) * f'(A_{l-1})   (GEMM) */
+static void backward_rows(const XnnBackprop *bp, size_t s)
+{
+    Network *net = bp->net, *grad = bp->grad;
+    size_t batch = bp->in.shape[0], L = net->layers-1;
+    size_t r0 = s*batch/bp->shards, rows = (s+1)*batch/bp->shards - r0;
+    if (forward_rows(net, &bp->in, r0, r0 + rows, net->ab, net->dm, net->loss == LOSS_CE)) {
+        __atomic_store_n(bp->err, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    bp->loss[s] = (float)output_rows(bp, r0, rows);
+
+    double sq = 0.0;
+    for (size_t l = L; l > 0; --l) {
+        const Matrix *W = net->w[l-1];
+        size_t n = W->rows, m = W->cols;
+        const float *D = grad->ab[l] + r0*n;
+        int staged = l > 1 || tensor_staged(&bp->in);   // else the GEMM reads the input view in place
+        const float *prev = staged ? net->ab[l-1] + r0*m : tensor_row(&bp->in, r0);
+        ptrdiff_t rs = staged ? (ptrdiff_t)m : bp->in.stride[0], cs = staged ? 1 : bp->in.stride[1];
+        float *dw = grad_shard(bp, s, l-1, 0), *db = grad_shard(bp, s, l-1, 1);
+        if (xnn_gemm(n, m, rows, bp->inv, D, 1, n, prev, rs, cs, 0.0f, dw, m)) {
+            __atomic_store_n(bp->err, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        xk()->fill(db, 0.0f, n);
+        for (size_t r = 0; r < rows; r++) xk()->add(db, D + r*n, n);
+        xk()->scale(db, bp->inv, n);
+        if (bp->shards == 1) sq += (double)xk()->sumsq(dw, n*m) + xk()->sumsq(db, n);
+        if (l > 1) {
+            float *Dp = grad->ab[l-1] + r0*m;
+            if (xnn_gemm_ep(rows, m, n, 1.0f, D, n, 1, network_wt(net, l-1), net->prec, m, 1, 0.0f, Dp, m, NULL)) {
+                __atomic_store_n(bp->err, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            dmask_mul(net, l-1, Dp, r0, rows);
+        }
+    }
+    if (bp->shards == 1) grad->grad_sq = (float)sq;
+}
+static void backward_range(void *ctx, size_t b, size_t e)
+{
+    for (size_t s = b; s < e; ++s) backward_rows((const XnnBackprop*)ctx, s);
+}
+/* One tree level: work items are (pair, chunk) pairs; adds items [b,e)
+ * and returns the level's item count. */
+static size_t reduce_items(const XnnBackprop *bp, size_t b, size_t e)
+{
+    size_t item = 0, len = bp->grad->nparams;
+    for (size_t s = 0; s + bp->step < bp->shards; s += 2*bp->step)
+        for (size_t i = 0; i < len; i += XNN_REDUCE_CHUNK, ++item)
+            if (item >= b && item < e) {
+                size_t n = len - i < XNN_REDUCE_CHUNK ? len - i : XNN_REDUCE_CHUNK;
+                xk()->add(shard_base(bp, s) + i, shard_base(bp, s + bp->step) + i, n);
+                if (bp->sq) bp->sq[item] = xk()->sumsq(shard_base(bp, s) + i, n);
+            }
+    return item;
+}
+static void reduce_range(void *ctx, size_t b, size_t e) { reduce_items((const XnnBackprop*)ctx, b, e); }
+
+static float backprop_run(Network *net, Network *grad, const Tensor *in, const Tensor *out, const uint16_t *labels)
+{
+    if(!net||!grad||grad->nparams!=net->nparams) return -1.0f;
+    float loss1 = 0.0f;
+    int err = 0;
+    XnnBackprop bp = { net, grad, tensor_bad(), tensor_bad(), (size_t)xnn_get_threads(), 0, 0, 0.0f, NULL, labels, &loss1, &err };
+    if(tensor_flat2(in, net->a[0]->rows, &bp.in)) return -1.0f;
+    if(!labels && (tensor_flat2(out, net->a[net->layers-1]->rows, &bp.out) || bp.out.u8)) return -1.0f;
+    size_t batch = bp.in.shape[0];
+    if(!batch || (!labels && batch!=bp.out.shape[0])) return -1.0f;
+    if(network_reserve(net, batch, 1, tensor_staged(&bp.in)) || network_reserve(grad, batch, 0, 0)) return -1.0f;
+    bp.inv = 1.0f/batch;
+    if (bp.shards > batch/XNN_SHARD_ROWS) bp.shards = batch/XNN_SHARD_ROWS;
+    size_t chunks = (grad->nparams + XNN_REDUCE_CHUNK-1)/XNN_REDUCE_CHUNK;
+    if (bp.shards > 1) {   // after the shards: |g|^2 per chunk, then loss per shard
+        bp.stride = (grad->nparams + 15) & ~(size_t)15;
+        size_t need = (bp.shards-1)*bp.stride + chunks + bp.shards;
+        if (need > grad->shard_cap) {
+            xnn_free(grad->shards);
+            grad->shards = xnn_alloc(need*sizeof(float));
+            grad->shard_cap = grad->shards ? need : 0;
+        }
+        if (!grad->shards) bp.shards = 1;
+        else bp.loss = grad->shards + (bp.shards-1)*bp.stride + chunks;
+    }
+    if (bp.shards < 1) bp.shards = 1;
+    xnn_parallel_for(0, bp.shards, 1, backward_range, &bp);
+    if (err) { grad->grad_sq = -1.0f; return -1.0f; }   /* out of memory: grad incomplete */
+    for (bp.step = 1; bp.step < bp.shards; bp.step *= 2) {
+        if (2*bp.step >= bp.shards) bp.sq = grad->shards + (bp.shards-1)*bp.stride;
+        size_t items = reduce_items(&bp, 0, 0);
+        xnn_parallel_for(0, items, 1, reduce_range, &bp);
+        if (!bp.sq) continue;
+        double sq = 0.0;
+        for (size_t i = 0; i < items; ++i) sq += bp.sq[i];
+        grad->grad_sq = (float)sq;
+    }
+    double loss = 0.0;
+    for (size_t s = 0; s < bp.shards; ++s) loss += bp.loss[s];
+    return (float)(loss / batch);
+}
+float backprop_view(Network *net, Network *grad, const Tensor *in, const Tensor *out)
+{
+    return backprop_run(net, grad, in, out, NULL);
+}
+/* labels[i] is the class of entry i of in's dim 0 before any gather, so
+ * one id array serves every tensor_gather batch of the same rows; ids
+ * past the output width count as no target. */
+float backprop_labels(Network *net, Network *grad, const Tensor *in, const uint16_t *labels)
+{
+    return labels ? backprop_run(net, grad, in, NULL, labels) : -1.0f;
+}
+float backprop(Network *net, Network *grad, const Data *data)
+{
+    if(!data||!data->in||(!data->out&&!data->labels)) return -1.0f;
+    Tensor in = matrix_view(data->in);
+    if (data->labels) return backprop_labels(net, grad, &in, data->labels);
+    Tensor out = matrix_view(data->out);
+    return backprop_view(net, grad, &in, &out);
+}
+/* In mixed precision the half copy is re-rounded a block at a time,
+ * while the freshly updated masters are still in L1. */
+void apply_grad(Network *net, const Network *grad, float rate)
+{
+    if(!net||!grad||net->nparams!=grad->nparams) return;
+    const XnnKernels *k = xk();
+    network_drop_sparse(net);
+    if (net->prec == PREC_FP32) { k->axpy(net->params, -rate, grad->params, net->nparams); return; }
+    for(size_t i=0;i<net->layers-1;i++){
+        float *w = net->w[i]->data;
+        size_t n = net->w[i]->rows*net->w[i]->cols;
+        for (size_t j = 0; j < n; j += 1024) {
+            size_t c = n-j < 1024 ? n-j : 1024;
+            k->axpy(w + j, -rate, grad->w[i]->data + j, c);
+            k->f2h[net->prec-1](net->wh[i] + j, w + j, c);
+        }
+        k->axpy(net->b[i]->data, -rate, grad->b[i]->data, net->b[i]->rows);
+    }
+}
+
+/* ---------- Optimizers ----------
+ * An optimizer owns its first/second moment buffers (one 64-byte aligned
+ * block, only what the method needs) and updates every parameter in a
+ * single fused pass: decay, moments, bias correction and the write all
+ * happen while the element is in registers, so a step streams w, g and
+ * the moments exactly once. The arena is cut into fixed chunks run on the
+ * pool, so results do not depend on the thread count. In mixed precision
+ * each chunk's half copy is re-rounded while it is still in L1.
+ * Clipping rides along: the global-norm scale comes from the |grad|^2 that
+ * backprop accumulated, per-value clipping is a clamp in the same pass.
+ * network_params forgets that norm, so a gradient edited through it is
+ * re-measured (one extra read), as optimizer_update always does. */
+#define XNN_OPT_CHUNK 4096   /* floats per work item */
+struct Optimizer {
+    int type;
+    size_t n, t;       // parameters, steps taken
+    float lr, beta1, beta2, eps, decay;
+    float max_norm, max_value;   // clipping, 0 = off
+    float *m, *v;      // moments, NULL when the method has none
+};
+typedef struct { XnnOptStep s; float *w, *m, *v; const float *g; size_t n; Network *net; } XnnOptRun;
+
+Optimizer *optimizer_alloc(size_t n, int type, float lr)
+{
+    if (!n || type < OPT_SGD || type > OPT_ADAMW) return NULL;
+    Optimizer *o = (Optimizer*)calloc(1, sizeof(Optimizer));
+    if (!o) return NULL;
+    o->type = type; o->n = n; o->lr = lr;
+    o->beta1 = 0.9f; o->beta2 = type == OPT_RMSPROP ? 0.99f : 0.999f;
+    o->eps = 1e-8f; o->decay = type == OPT_ADAMW ? 0.01f : 0.0f;
+    size_t k = type == OPT_SGD ? 0 : type >= OPT_ADAM ? 2 : 1;   // moment buffers
+    size_t stride = (n + 15) & ~(size_t)15;
+    float *buf = k ? (float*)xnn_alloc(k*stride*sizeof(float)) : NULL;
+    if (k && !buf) { free(o); return NULL; }
+    if (buf) memset(buf, 0, k*stride*sizeof(float));
+    if (type == OPT_RMSPROP) o->v = buf;
+    else if (k) { o->m = buf; if (k == 2) o->v = buf + stride; }
+    return o;
+}
+void optimizer_free(Optimizer *o)
+{
+    if (!o) return;
+    xnn_free(o->m ? o->m : o->v);
+    free(o);
+}
+void optimizer_set_lr(Optimizer *o, float lr) { if (o) o->lr = lr; }
+void optimizer_set_hparams(Optimizer *o, float beta1, float beta2, float eps, float decay)
+{
+    if (!o) return;
+    o->beta1 = beta1; o->beta2 = beta2; o->eps = eps; o->decay = decay;
+}
+void optimizer_set_clip(Optimizer *o, float max_norm, float max_value)
+{
+    if (!o) return;
+    o->max_norm = max_norm > 0 ? max_norm : 0.0f;
+    o->max_value = max_value > 0 ? max_value : 0.0f;
+}
+
+/* Fold step t's hyperparameters, and the clip scale for a gradient with
+ * squared norm gsq, into per-element constants. */
+static XnnOptStep opt_prepare(Optimizer *o, float gsq)
+{
+    XnnOptStep s = { o->lr, 1.0f, o->decay, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, o->eps, 1.0f,
+                     o->max_value > 0 ? o->max_value : INFINITY };
+    if (o->max_norm > 0 && gsq > o->max_norm*o->max_norm) s.gs = o->max_norm / sqrtf(gsq);
+    ++o->t;
+    if (o->type == OPT_MOMENTUM) { s.b1 = o->beta1; s.a1 = 1.0f; }
+    if (o->type == OPT_RMSPROP) { s.b2 = o->beta2; s.a2 = 1.0f - o->beta2; }
+    if (o->type >= OPT_ADAM) {
+        s.b1 = o->beta1; s.a1 = 1.0f - o->beta1;
+        s.b2 = o->beta2; s.a2 = 1.0f - o->beta2;
+        s.lr = (float)(o->lr / (1.0 - pow(o->beta1, (double)o->t)));
+        s.vs = (float)(1.0 / sqrt(1.0 - pow(o->beta2, (double)o->t)));
+    }
+    if (o->type == OPT_ADAMW) { s.l2 = 0.0f; s.keep = 1.0f - o->lr*o->decay; }
+    return s;
+}
+static void opt_range(void *ctx, size_t b, size_t e)
+{
+    const XnnOptRun *r = (const XnnOptRun*)ctx;
+    const XnnKernels *k = xk();
+    for (size_t c = b; c < e; ++c) {
+        size_t i = c*XNN_OPT_CHUNK, len = r->n - i < XNN_OPT_CHUNK ? r->n - i : XNN_OPT_CHUNK;
+        k->opt(&r->s, r->w + i, r->m ? r->m + i : NULL, r->v ? r->v + i : NULL, r->g + i, len);
+        if (!r->net || r->net->prec == PREC_FP32) continue;
+        for (size_t l = 0; l + 1 < r->net->layers; ++l) {   // the w ranges this chunk touches
+            size_t lo = (size_t)(r->net->w[l]->data - r->net->params);
+            size_t hi = lo + r->net->w[l]->rows*r->net->w[l]->cols;
+            size_t a = i > lo ? i : lo, z = i + len < hi ? i + len : hi;
+            if (a < z) k->f2h[r->net->prec-1](r->net->wh[l] + (a - lo), r->net->params + a, z - a);
+        }
+    }
+}
+/* gsq < 0: not known, measured here when global clipping needs it */
+static void opt_run(Optimizer *o, float *w, const float *g, float gsq, Network *net)
+{
+    if (o->max_norm > 0 && gsq < 0) gsq = xk()->sumsq(g, o->n);
+    XnnOptRun r = { opt_prepare(o, gsq), w, o->m, o->v, g, o->n, net };
+    xnn_parallel_for(0, (o->n + XNN_OPT_CHUNK-1)/XNN_OPT_CHUNK, 1, opt_range, &r);
+}
+void optimizer_step(Optimizer *o, Network *net, const Network *grad)
+{
+    if (!o || !net || !grad || net->nparams != o->n || grad->nparams != o->n) return;
+    network_drop_sparse(net);
+    opt_run(o, net->params, grad->params, grad->grad_sq, net);
+}
+void optimizer_update(Optimizer *o, float *w, const float *g)
+{
+    if (o && w && g) opt_run(o, w, g, -1.0f, NULL);
+}
+
+/* ---------- Inference sessions ----------
+ * A session is the activation workspace for read-only inference on a
+ * borrowed network: two ping-pong buffers of rows x widest layer, layer l
+ * writing act[l] = buf[l & 1] (a gathered input is staged in act[0]). Any
+ * number of sessions may run on one network at once, as long as nothing
+ * trains or reconfigures it meanwhile. network_predict and network_mse run
+ * on a per-thread session, so they neither write to the network nor
+ * allocate once it has grown; a thread's session is freed when it exits. */
+struct InferenceSession {
+    const Network *net;
+    size_t cap, width, layers;   // buf: cap x width floats each; act: `layers` slots
+    float *buf[2];
+    float **act;
+    Matrix out;
+};
+static __thread InferenceSession xnn_tls_session;
+static pthread_key_t xnn_tls_key;
+static pthread_once_t xnn_tls_once = PTHREAD_ONCE_INIT;
+
+static void session_release(InferenceSession *s)
+{
+    xnn_free(s->buf[0]); xnn_free(s->buf[1]);
+    free(s->act);
+    memset(s, 0, sizeof *s);
+}
+static void xnn_tls_free(void *s) { session_release((InferenceSession*)s); }
+static void xnn_tls_init(void) { pthread_key_create(&xnn_tls_key, xnn_tls_free); }
+/* the calling thread's session; registering it makes thread exit free it */
+static InferenceSession *xnn_tls(void)
+{
+    if (!xnn_tls_session.layers) {
+        pthread_once(&xnn_tls_once, xnn_tls_init);
+        pthread_setspecific(xnn_tls_key, &xnn_tls_session);
+    }
+    return &xnn_tls_session;
+}
+
+static int session_fit(InferenceSession *s, const Network *net, size_t rows)
+{
+    size_t width = 0;
+    for (size_t l = 0; l < net->layers; ++l) if (net->a[l]->rows > width) width = net->a[l]->rows;
+    if (net->layers > s->layers) {
+        float **act = realloc(s->act, net->layers*sizeof(float*));
+        if (!act) return -1;
+        s->act = act; s->layers = net->layers;
+    }
+    if (rows > s->cap || width > s->width) {
+        if (rows < s->cap) rows = s->cap;
+        if (width < s->width) width = s->width;
+        s->cap = s->width = 0;
+        for (int i = 0; i < 2; ++i) {
+            xnn_free(s->buf[i]);
+            if (!(s->buf[i] = xnn_alloc(rows*width*sizeof(float)))) return -1;
+        }
+        s->cap = rows; s->width = width;
+    }
+    for (size_t l = 0; l < net->layers; ++l) s->act[l] = s->buf[l & 1];
+    return 0;
+}
+static const Matrix *session_run(InferenceSession *s, const Network *net, const Tensor *x)
+{
+    Tensor v;
+    if (tensor_flat2(x, net->a[0]->rows, &v) || session_fit(s, net, v.shape[0]) ||
+        forward_rows(net, &v, 0, v.shape[0], s->act, NULL, 0)) return NULL;
+    s->out.rows = v.shape[0];
+    s->out.cols = net->a[net->layers-1]->rows;
+    s->out.data = s->act[net->layers-1];
+    return &s->out;
+}
+InferenceSession *session_alloc(const Network *net, size_t rows)
+{
+    if (!net) return NULL;
+    InferenceSession *s = calloc(1, sizeof *s);
+    if (!s) return NULL;
+    s->net = net;
+    if (session_fit(s, net, rows ? rows : 1)) { session_free(s); return NULL; }
+    return s;
+}
+void session_free(InferenceSession *s)
+{
+    if (!s) return;
+    session_release(s);
+    free(s);
+}
+const Matrix *session_forward(InferenceSession *s, const Tensor *x)
+{ return s ? session_run(s, s->net, x) : NULL; }
+void session_predict(InferenceSession *s, const float *input, float *output)
+{
+    if (!s || !input || !output) return;
+    Matrix m = { 1, s->net->a[0]->rows, (float*)input };
+    Tensor x = matrix_view(&m);
+    const Matrix *y = session_run(s, s->net, &x);
+    if (y) memcpy(output, y->data, y->cols * sizeof(float));
+}
+
+/* ---------- Save / Load ---------- */
+int network_save(const Network *net, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    /* params is already in file order: [w0 b0 w1 b1 ...] */
+    int ok = fwrite(&net->layers, sizeof(size_t), 1, f) == 1 &&
+             fwrite(&net->loss, sizeof(int), 1, f) == 1 &&
+             fwrite(net->params, sizeof(float), net->nparams, f) == net->nparams;
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+Network *network_load(const char *path, const size_t *arch, size_t n, const int *act, int loss)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    size_t layers;
+    int saved_loss;
+    if (fread(&layers, sizeof(size_t), 1, f) != 1 || layers != n) {
+        fclose(f);
+        return NULL;
+    }
+    if (fread(&saved_loss, sizeof(int), 1, f) != 1 || saved_loss != loss) {
+        fclose(f);
+        return NULL;
+    }
+
+    Network *net = network_make(arch, n, act, loss);
+    if (!net) {
+        fclose(f);
+        return NULL;
+    }
+
+    if (fread(net->params, sizeof(float), net->nparams, f) != net->nparams) {
+        network_free(net);
+        fclose(f);
+        return NULL;
+    }
+
+    fclose(f);
+    return net;
+}
+
+/* ---------- Utilities ---------- */
+/* Whole file, copy-on-write: mmap'd on Linux, read into an xnn_alloc
+ * block elsewhere. Either way the start is 64-byte aligned. */
+static char *xnn_map_file(const char *path, size_t *size)
+{
+#if defined(__linux__)
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) || st.st_size <= 0) { close(fd); return NULL; }
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+    madvise(p, (size_t)st.st_size, MADV_WILLNEED);
+    *size = (size_t)st.st_size;
+    return (char*)p;
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    long n = fseek(f, 0, SEEK_END) ? -1 : ftell(f);
+    char *p = n > 0 ? (char*)xnn_alloc((size_t)n) : NULL;
+    if (p && (fseek(f, 0, SEEK_SET) || fread(p, 1, (size_t)n, f) != (size_t)n)) { xnn_free(p); p = NULL; }
+    fclose(f);
+    if (p) *size = (size_t)n;
+    return p;
+#endif
+}
+static void xnn_unmap_file(const char *p, size_t size)
+{
+#if defined(__linux__)
+    if (p) munmap((void*)p, size);
+#else
+    (void)size; xnn_free((void*)p);
+#endif
+}
+
+/* ---------- CSV ----------
+ * The file is cut into XNN_CSV_CHUNK pieces at line starts; one pass on
+ * the pool counts each piece's rows, a second parses every piece straight
+ * into its rows. The width is the first row's field count. Blank lines
+ * and \r\n are fine; a first line with no number in any numeric column is
+ * a header and skipped. On a bad or ragged line matrix_load_csv returns NULL
+ * with *err_line = its 1-based number (the first one, however the pieces
+ * ran); I/O errors and empty files leave 0. */
+#define XNN_CSV_CHUNK ((size_t)1 << 20)
+
+static const double xnn_pow10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/* Number at p -> *v, returns where it ends or NULL. A mantissa up to 2^53
+ * and a power of ten within 1e+-22 are both exact doubles, so one multiply
+ * or divide rounds once, like strtod; anything else goes through strtod. */
+static const char *csv_number(const char *p, const char *end, float *v)
+{
+    const char *s = p, *d0;
+    int neg = 0, e = 0;
+    uint64_t m = 0;
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    for (d0 = p; p < end && (unsigned)(*p - '0') < 10; ++p) m = m*10 + (unsigned)(*p - '0');
+    size_t digits = (size_t)(p - d0);
+    if (p < end && *p == '.') {
+        for (d0 = ++p; p < end && (unsigned)(*p - '0') < 10; ++p) m = m*10 + (unsigned)(*p - '0');
+        e = -(int)(p - d0);
+        digits += (size_t)(p - d0);
+    }
+    if (digits && p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int en = 0, x = 0, d = 0;
+        if (q < end && (*q == '-' || *q == '+')) en = *q++ == '-';
+        for (; q < end && (unsigned)(*q - '0') < 10; ++q, d = 1) { if (x < 10000) x = x*10 + (*q - '0'); }
+        if (d) { e += en ? -x : x; p = q; }
+    }
+    if (digits && digits <= 19 && m <= (uint64_t)1 << 53 && e >= -22 && e <= 22) {
+        double d = (double)m;
+        d = e < 0 ? d / xnn_pow10[-e] : e ? d * xnn_pow10[e] : d;
+        *v = (float)(neg ? -d : d);
+        return p;
+    }
+    char buf[64], *q;
+    size_t n = 0;
+    for (p = s; p < end && n < sizeof buf - 1 && *p != ',' && *p != '\n' && *p != '\r' && *p != ' ' && *p != '\t'; ++p)
+        buf[n++] = *p;
+    buf[n] = 0;
+    double d = strtod(buf, &q);
+    if (q == buf) return NULL;
+    *v = (float)d;
+    return s + (q - buf);
+}
+
+static int csv_blank(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    return p == end || *p == '\n';
+}
+
+/* One line into row[0..cols); returns the next line, NULL if it doesn't fit */
+static const char *csv_row(const char *p, const char *end, float *row, size_t cols)
+{
+    for (size_t j = 0; j < cols; ++j) {
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        if (!(p = csv_number(p, end, &row[j]))) return NULL;
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        if (j + 1 < cols && (p == end || *p++ != ',')) return NULL;
+    }
+    if (p < end && *p == '\r') ++p;
+    if (p < end && *p++ != '\n') return NULL;
+    return p;
+}
+
+typedef struct { int kind; uint32_t dst; float scale, offset; uint32_t classes; } XnnCsvCol;
+typedef struct {
+    const char *buf;
+    size_t size, chunks, rows;
+    size_t *start;   // chunks+1 byte offsets, each at a line start
+    size_t *row0;    // rows in chunk c, then (prefix sums) its first row
+    size_t *line0;   // lines before chunk c, 0-based
+    size_t cols;
+    float *data;     // rows x cols, or with route set:
+    const XnnCsvCol *route;   // per column: where the value goes
+    float *in, *out;
+    uint16_t *labels;
+    size_t in_cols, out_cols;
+    size_t bad;      // first bad line, SIZE_MAX = none
+} XnnCsv;
+
+/* One line routed column by column (see CsvColumn); NULL if it doesn't fit */
+static const char *csv_route(const XnnCsv *c, const char *p, const char *end, size_t r)
+{
+    float *in = c->in + r*c->in_cols, *out = c->out ? c->out + r*c->out_cols : NULL, v = 0.0f;
+    for (size_t j = 0; j < c->cols; ++j) {
+        const XnnCsvCol *k = &c->route[j];
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        if (k->kind == CSV_SKIP) {
+            while (p < end && *p != ',' && *p != '\n' && *p != '\r') ++p;
+        } else if (!(p = csv_number(p, end, &v))) return NULL;
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        if (j + 1 < c->cols && (p == end || *p++ != ',')) return NULL;
+        switch (k->kind) {
+        case CSV_FEATURE: in[k->dst] = v*k->scale + k->offset; break;
+        case CSV_TARGET:  out[k->dst] = v*k->scale + k->offset; break;
+        case CSV_LABEL:
+            if (!(v >= 0.0f && v <= 65535.0f && v == (float)(int)v)) return NULL;
+            c->labels[r] = (uint16_t)v;
+            break;
+        case CSV_ONEHOT:
+            if (!(v >= 0.0f && v < (float)k->classes && v == (float)(int)v)) return NULL;
+            memset(out + k->dst, 0, k->classes*sizeof(float));
+            out[k->dst + (size_t)v] = 1.0f;
+            break;
+        }
+    }
+    if (p < end && *p == '\r') ++p;
+    if (p < end && *p++ != '\n') return NULL;
+    return p;
+}
+
+static void csv_count_range(void *ctx, size_t b, size_t e)
+{
+    XnnCsv *c = (XnnCsv*)ctx;
+    for (size_t k = b; k < e; ++k) {
+        const char *p = c->buf + c->start[k], *end = c->buf + c->start[k+1];
+        size_t rows = 0, lines = 0;
+        while (p < end) {
+            const char *nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+            rows += !csv_blank(p, end);
+            ++lines;
+            p = nl ? nl + 1 : end;
+        }
+        c->row0[k] = rows; c->line0[k] = lines;
+    }
+}
+static void csv_parse_range(void *ctx, size_t b, size_t e)
+{
+    XnnCsv *c = (XnnCsv*)ctx;
+    for (size_t k = b; k < e; ++k) {
+        const char *p = c->buf + c->start[k], *end = c->buf + c->start[k+1];
+        size_t row = c->row0[k], line = c->line0[k];
+        for (; p < end && line < __atomic_load_n(&c->bad, __ATOMIC_RELAXED); ++line) {
+            if (csv_blank(p, end)) {
+                const char *nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+                p = nl ? nl + 1 : end;
+                continue;
+            }
+            p = c->route ? csv_route(c, p, end, row) : csv_row(p, end, c->data + row*c->cols, c->cols);
+            ++row;
+            if (!p) {
+                size_t cur = __atomic_load_n(&c->bad, __ATOMIC_RELAXED);
+                while (line + 1 < cur &&
+                       !__atomic_compare_exchange_n(&c->bad, &cur, line + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+                break;
+            }
+        }
+    }
+}
+
+/* Is any numeric column of the line a whole number? spec NULL: all are */
+static int csv_has_number(const char *p, const char *end, const CsvColumn *spec, size_t nspec)
+{
+    for (size_t j = 0; p < end && *p != '\n'; ++j) {
+        const char *q;
+        float v;
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        if ((!spec || spec[j < nspec ? j : nspec - 1].kind != CSV_SKIP) && (q = csv_number(p, end, &v))) {
+            while (q < end && (*q == ' ' || *q == '\t' || *q == '\r')) ++q;
+            if (q == end || *q == ',' || *q == '\n') return 1;
+        }
+        while (p < end && *p != ',' && *p != '\n') ++p;
+        if (p < end && *p == ',') ++p;
+    }
+    return 0;
+}
+
+/* Map the file, skip blank lines and a header, take the width from the
+ * first row, cut the chunks and count every chunk's rows */
+static int csv_open(XnnCsv *c, const char *path, const CsvColumn *spec, size_t nspec)
+{
+    memset(c, 0, sizeof *c);
+    c->bad = SIZE_MAX;
+    char *buf = path ? xnn_map_file(path, &c->size) : NULL;
+    if (!(c->buf = buf)) return -1;
+    const char *p = buf, *end = buf + c->size;
+    size_t skip = 0;
+    for (int header = 1; p < end; ++skip) {
+        const char *nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (!csv_blank(p, end)) {
+            if (!header || csv_has_number(p, end, spec, nspec)) break;
+            header = 0;
+        }
+        p = nl ? nl + 1 : end;
+    }
+    c->cols = 1;
+    for (const char *q = p; q < end && *q != '\n'; ++q) c->cols += *q == ',';
+    size_t cap = (size_t)(end - p) / XNN_CSV_CHUNK + 2;
+    if (p == end || !(c->start = (size_t*)malloc(3 * cap * sizeof(size_t)))) return -1;
+    c->row0 = c->start + cap; c->line0 = c->row0 + cap;
+
+    c->start[0] = (size_t)(p - buf);
+    for (size_t off = c->start[0] + XNN_CSV_CHUNK; off < c->size; off = c->start[c->chunks] + XNN_CSV_CHUNK) {
+        const char *nl = (const char*)memchr(buf + off, '\n', c->size - off);
+        if (!nl || (size_t)(nl + 1 - buf) >= c->size) break;
+        c->start[++c->chunks] = (size_t)(nl + 1 - buf);
+    }
+    c->start[++c->chunks] = c->size;
+    xnn_parallel_for(0, c->chunks, 1, csv_count_range, c);
+    size_t lines = skip;
+    for (size_t k = 0; k < c->chunks; ++k) {
+        size_t r = c->row0[k], l = c->line0[k];
+        c->row0[k] = c->rows; c->line0[k] = lines;
+        c->rows += r; lines += l;
+    }
+    return c->rows ? 0 : -1;
+}
+static size_t csv_parse(XnnCsv *c)
+{
+    xnn_parallel_for(0, c->chunks, 1, csv_parse_range, c);
+    return c->bad == SIZE_MAX ? 0 : c->bad;
+}
+static void csv_close(XnnCsv *c)
+{
+    free(c->start);
+    xnn_unmap_file(c->buf, c->size);
+}
+
+Matrix *matrix_load_csv(const char *path, size_t *err_line)
+{
+    XnnCsv c;
+    size_t dummy;
+    if (!err_line) err_line = &dummy;
+    *err_line = 0;
+    Matrix *m = csv_open(&c, path, NULL, 0) ? NULL : matrix_alloc(c.rows, c.cols);
+    if (m) {
+        c.data = m->data;
+        if ((*err_line = csv_parse(&c))) { matrix_free(m); m = NULL; }
+    }
+    csv_close(&c);
+    return m;
+}
+
+int data_load_csv(Data *d, const char *path, const CsvColumn *spec, size_t nspec, size_t *err_line)
+{
+    XnnCsv c;
+    size_t dummy;
+    if (!err_line) err_line = &dummy;
+    *err_line = 0;
+    if (!d || !spec || !nspec) return -1;
+    memset(d, 0, sizeof *d);
+    if (csv_open(&c, path, spec, nspec)) { csv_close(&c); return -1; }
+    XnnCsvCol *route = (XnnCsvCol*)calloc(c.cols, sizeof *route);
+    int labels = 0, ok = route != NULL;
+    for (size_t j = 0; ok && j < c.cols; ++j) {
+        const CsvColumn *s = &spec[j < nspec ? j : nspec - 1];
+        XnnCsvCol *k = &route[j];
+        k->kind = s->kind; k->scale = s->scale ? s->scale : 1.0f; k->offset = s->offset;
+        if (s->kind == CSV_FEATURE) k->dst = (uint32_t)c.in_cols++;
+        else if (s->kind == CSV_TARGET) k->dst = (uint32_t)c.out_cols++;
+        else if (s->kind == CSV_ONEHOT && s->classes) { k->dst = (uint32_t)c.out_cols; k->classes = s->classes; c.out_cols += s->classes; }
+        else if (s->kind == CSV_LABEL) ok = !labels++;
+        else ok = s->kind == CSV_SKIP;
+    }
+    if (ok && c.in_cols && (d->in = matrix_alloc(c.rows, c.in_cols)) &&
+        (!c.out_cols || (d->out = matrix_alloc(c.rows, c.out_cols))) &&
+        (!labels || (d->labels = (uint16_t*)malloc(c.rows * sizeof(uint16_t))))) {
+        c.route = route; c.in = d->in->data; c.out = d->out ? d->out->data : NULL;
+        c.labels = (uint16_t*)d->labels;
+        ok = !(*err_line = csv_parse(&c));
+    } else ok = 0;
+    free(route);
+    csv_close(&c);
+    if (!ok) data_free(d);
+    return ok ? 0 : -1;
+}
+void data_free(Data *d)
+{
+    if (!d) return;
+    matrix_free(d->in); matrix_free(d->out); free((void*)d->labels);
+    memset(d, 0, sizeof *d);
+}
+
+Matrix *matrix_from_csv(const char *path, size_t rows, size_t cols)
+{
+    Matrix *m = matrix_load_csv(path, NULL);
+    if (m && ((rows && rows > m->rows) || (cols && cols != m->cols))) { matrix_free(m); return NULL; }
+    if (m && rows) m->rows = rows;
+    return m;
+}
+
+/* ---------- Dataset files ----------
+ * A DatasetHeader and the payloads; dataset_open maps the file and points
+ * Matrix headers at it, so a repeat start costs a page-table setup. */
+static const char xnn_dataset_magic[8] = "XNNDATA";
+
+static int dataset_write(FILE *f, const void *p, size_t bytes, uint64_t *off)
+{
+    static const char zero[64] = {0};
+    size_t pad = (size_t)(-*off & 63);
+    if (fwrite(zero, 1, pad, f) != pad || fwrite(p, 1, bytes, f) != bytes) return -1;
+    *off += pad + bytes;
+    return 0;
+}
+static int dataset_write_data(const Data *data, float scale, float offset, const char *path)
+{
+    if (!data || !data->in || !path || (data->out && data->out->rows != data->in->rows)) return -1;
+    DatasetHeader h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, xnn_dataset_magic, sizeof h.magic);
+    h.version = XNN_DATASET_VERSION; h.dtype = XNN_F32;
+    h.rows = data->in->rows; h.in_cols = data->in->cols;
+    h.out_cols = data->out ? data->out->cols : 0;
+    h.scale = scale; h.offset = offset;
+    for (size_t i = 0; data->labels && i < h.rows; ++i)
+        if (data->labels[i] >= h.classes) h.classes = data->labels[i] + 1u;
+
+    /* offsets first: each payload rounded up to 64 after the previous */
+    uint64_t end = sizeof h, in_b = h.rows*h.in_cols*sizeof(float), out_b = h.rows*h.out_cols*sizeof(float);
+    h.in_off = end = (end + 63) & ~(uint64_t)63; end += in_b;
+    if (h.out_cols) { h.out_off = end = (end + 63) & ~(uint64_t)63; end += out_b; }
+    if (h.classes) h.labels_off = (end + 63) & ~(uint64_t)63;
+
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    uint64_t off = 0;
+    int ok = !dataset_write(f, &h, sizeof h, &off) && !dataset_write(f, data->in->data, in_b, &off) &&
+             (!h.out_cols || !dataset_write(f, data->out->data, out_b, &off)) &&
+             (!h.classes || !dataset_write(f, data->labels, h.rows*sizeof(uint16_t), &off));
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+int dataset_save(const Data *data, const char *path) { return dataset_write_data(data, 1.0f, 0.0f, path); }
+
+/* label_col < 0: every column is a feature; otherwise that column must hold
+ * integer class ids 0..65535 and the rest, times scale, are the features */
+int dataset_from_csv(const char *csv, const char *path, long label_col, float scale, size_t *err_line)
+{
+    size_t n = label_col < 0 ? 1 : (size_t)label_col + 2;   // the last entry covers the rest
+    CsvColumn *spec = (CsvColumn*)calloc(n, sizeof *spec);
+    Data d;
+    if (!spec) return -1;
+    for (size_t j = 0; j < n; ++j) { spec[j].kind = CSV_FEATURE; spec[j].scale = scale; }
+    if (label_col >= 0) spec[label_col].kind = CSV_LABEL;
+    int rc = data_load_csv(&d, csv, spec, n, err_line);
+    free(spec);
+    if (rc) return -1;
+    rc = label_col >= 0 && !d.labels ? -1 : dataset_write_data(&d, scale, 0.0f, path);
+    data_free(&d);
+    return rc;
+}
+
+struct Dataset {
+    char *map;
+    size_t size;
+    DatasetHeader h;
+    Matrix in, out;
+    Data data;
+};
+
+/* every payload aligned and inside the file, sizes without overflow */
+static int dataset_check(const DatasetHeader *h, size_t size)
+{
+    if (memcmp(h->magic, xnn_dataset_magic, sizeof h->magic) || h->version != XNN_DATASET_VERSION ||
+        h->dtype != XNN_F32 || !h->rows || !h->in_cols) return -1;
+    uint64_t need[3][3] = { {h->in_off, h->in_cols, sizeof(float)}, {h->out_off, h->out_cols, sizeof(float)},
+                            {h->labels_off, (uint64_t)(h->classes != 0), sizeof(uint16_t)} };
+    for (int k = 0; k < 3; ++k) {
+        uint64_t off = need[k][0], cols = need[k][1], row;
+        if (!cols) continue;
+        if (cols > SIZE_MAX / need[k][2]) return -1;
+        row = cols * need[k][2];
+        if (h->rows > SIZE_MAX / row || !off || (off & 63) || off > size || h->rows * row > size - off) return -1;
+    }
+    return 0;
+}
+
+Dataset *dataset_open(const char *path)
+{
+    size_t size = 0;
+    char *map = path ? xnn_map_file(path, &size) : NULL;
+    Dataset *ds = map && size >= sizeof(DatasetHeader) ? (Dataset*)calloc(1, sizeof *ds) : NULL;
+    if (ds) memcpy(&ds->h, map, sizeof ds->h);
+    if (!ds || dataset_check(&ds->h, size)) {
+        free(ds);
+        xnn_unmap_file(map, size);
+        return NULL;
+    }
+    const DatasetHeader *h = &ds->h;
+    ds->map = map; ds->size = size;
+    ds->in = (Matrix){ h->rows, h->in_cols, (float*)(map + h->in_off) };
+    ds->out = (Matrix){ h->rows, h->out_cols, h->out_cols ? (float*)(map + h->out_off) : NULL };
+    ds->data.in = &ds->in;
+    ds->data.out = h->out_cols ? &ds->out : NULL;
+    ds->data.labels = h->classes ? (const uint16_t*)(map + h->labels_off) : NULL;
+    return ds;
+}
+const Data *dataset_data(const Dataset *ds) { return ds ? &ds->data : NULL; }
+const DatasetHeader *dataset_header(const Dataset *ds) { return ds ? &ds->h : NULL; }
+void dataset_close(Dataset *ds)
+{
+    if (!ds) return;
+    xnn_unmap_file(ds->map, ds->size);
+    free(ds);
+}
+
+/* ---------- Streaming ----------
+ * Shards in dataset_save's format, read by a background thread into one
+ * window of rows while the caller trains on the other: two windows are all
+ * that is resident, however large the shards. Every epoch visits the shards
+ * in a fresh order; rows are read in file order and scattered to shuffled
+ * slots of their window, so a batch is a contiguous slice handed out with
+ * no copy. posix_fadvise asks for the next chunk while the current one is
+ * read and drops its pages afterwards, so a pass over more data than RAM
+ * doesn't evict everything else.
+ * stream_open: shards must agree on in_cols, out_cols and having labels;
+ * window is rows per shuffle window (0 = 32 batches, rounded up to whole
+ * batches); seed 0 keeps file order. stream_next's views stay valid until
+ * the next call; rows left over at an epoch's end (< batch) are skipped. */
+#define XNN_STREAM_CHUNK (1u << 20)   /* bytes of in per read */
+
+typedef struct {
+    float *in, *out;
+    uint16_t *labels;
+    size_t rows;
+    int full, end, err;   // full: owned by the consumer; end: last of its epoch
+} XnnWindow;
+
+struct DataStream {
+    char **paths;
+    DatasetHeader *hs;    // per shard, as opened
+    DatasetHeader h;      // rows of all shards, offsets 0
+    size_t n, batch, window, chunk;
+    uint64_t rng;         // 0 = no shuffling
+    XnnWindow w[2];
+    float *stage;         // one chunk as read: in rows, then out rows
+    uint16_t *stage_l;
+    size_t *order, *perm;
+    pthread_t th;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    int started, stop, have;
+    size_t cur, pos;      // consumer: window and next row in it
+    Matrix bin, bout;
+};
+
+static uint64_t xnn_rng(uint64_t *s)   /* splitmix64 */
+{
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ull);
+    z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ z >> 27) * 0x94d049bb133111ebull;
+    return z ^ z >> 31;
+}
+static void xnn_shuffle(size_t *p, size_t n, uint64_t *s)
+{
+    for (size_t i = 0; i < n; ++i) p[i] = i;
+    for (size_t i = n; *s && i > 1; --i) {
+        size_t j = (size_t)(xnn_rng(s) % i), t = p[i-1];
+        p[i-1] = p[j]; p[j] = t;
+    }
+}
+
+static int stream_read(FILE *f, uint64_t off, void *dst, size_t bytes)
+{ return bytes && (fseeko(f, (off_t)off, SEEK_SET) || fread(dst, 1, bytes, f) != bytes) ? -1 : 0; }
+
+/* unbuffered, so reads go straight to the kernel; header read and checked */
+static FILE *stream_file(const char *path, DatasetHeader *h)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    setvbuf(f, NULL, _IONBF, 0);
+    off_t size = fseeko(f, 0, SEEK_END) ? -1 : ftello(f);
+    if (size >= (off_t)sizeof *h && !stream_read(f, 0, h, sizeof *h) && !dataset_check(h, (size_t)size)) return f;
+    fclose(f);
+    return NULL;
+}
+
+/* page-cache hints for rows [r, r+c) of a shard: fetch ahead, or drop once read */
+static void stream_advise(FILE *f, const DatasetHeader *h, size_t r, size_t c, int drop)
+{
+#if defined(__linux__) && defined(POSIX_FADV_DONTNEED)
+    uint64_t off[3] = { h->in_off, h->out_off, h->labels_off };
+    uint64_t row[3] = { h->in_cols*sizeof(float), h->out_cols*sizeof(float), h->classes ? sizeof(uint16_t) : 0 };
+    for (int k = 0; k < 3 && c; ++k)
+        if (row[k]) posix_fadvise(fileno(f), (off_t)(off[k] + r*row[k]), (off_t)(c*row[k]),
+                                  drop ? POSIX_FADV_DONTNEED : POSIX_FADV_WILLNEED);
+#else
+    (void)f; (void)h; (void)r; (void)c; (void)drop;
+#endif
+}
+
+static void *stream_worker(void *arg)
+{
+    DataStream *s = (DataStream*)arg;
+    const size_t ic = s->h.in_cols, oc = s->h.out_cols;
+    float *sin = s->stage, *sout = s->stage + s->chunk*ic;
+    FILE *f = NULL;
+    size_t k = 0, r = 0, left = 0, fill = 0;
+    int err = 0;
+    while (!err) {
+        XnnWindow *w = &s->w[fill];
+        pthread_mutex_lock(&s->mu);
+        while (w->full && !s->stop) pthread_cond_wait(&s->cv, &s->mu);
+        int stop = s->stop;
+        pthread_mutex_unlock(&s->mu);
+        if (stop) break;
+        if (!left) {   // a new epoch
+            if (f) fclose(f);
+            f = NULL;
+            xnn_shuffle(s->order, s->n, &s->rng);
+            left = s->h.rows; k = r = 0;
+        }
+        size_t n = left < s->window ? left : s->window;
+        xnn_shuffle(s->perm, n, &s->rng);
+        for (size_t i = 0; i < n && !err; ) {
+            const DatasetHeader *h = &s->hs[s->order[k]];
+            if (r == h->rows) { if (f) fclose(f); f = NULL; ++k; r = 0; continue; }
+            DatasetHeader fh;
+            if (!f && (!(f = stream_file(s->paths[s->order[k]], &fh)) || memcmp(&fh, h, sizeof fh))) { err = 1; break; }
+            size_t c = h->rows - r < n - i ? h->rows - r : n - i;
+            if (c > s->chunk) c = s->chunk;
+            stream_advise(f, h, r + c, h->rows - r - c < s->chunk ? h->rows - r - c : s->chunk, 0);
+            err = stream_read(f, h->in_off + r*ic*sizeof(float), sin, c*ic*sizeof(float)) ||
+                  stream_read(f, h->out_off + r*oc*sizeof(float), sout, c*oc*sizeof(float)) ||
+                  (w->labels && stream_read(f, h->labels_off + r*sizeof(uint16_t), s->stage_l, c*sizeof(uint16_t)));
+            stream_advise(f, h, r, c, 1);
+            for (size_t j = 0; j < c && !err; ++j) {
+                size_t d = s->perm[i+j];
+                memcpy(w->in + d*ic, sin + j*ic, ic*sizeof(float));
+                if (oc) memcpy(w->out + d*oc, sout + j*oc, oc*sizeof(float));
+                if (w->labels) w->labels[d] = s->stage_l[j];
+            }
+            i += c; r += c;
+        }
+        left -= n;
+        pthread_mutex_lock(&s->mu);
+        w->rows = n; w->end = !left; w->err = err; w->full = 1;
+        pthread_cond_broadcast(&s->cv);
+        pthread_mutex_unlock(&s->mu);
+        fill ^= 1;
+    }
+    if (f) fclose(f);
+    return NULL;
+}
+
+DataStream *stream_open(const char *const *paths, size_t n, size_t batch, size_t window, uint64_t seed)
+{
+    if (!paths || !n || !batch) return NULL;
+    DataStream *s = (DataStream*)calloc(1, sizeof *s);
+    if (!s) return NULL;
+    pthread_mutex_init(&s->mu, NULL);
+    pthread_cond_init(&s->cv, NULL);
+    s->n = n; s->batch = batch; s->rng = seed;
+    s->paths = (char**)calloc(n, sizeof *s->paths);
+    s->hs = (DatasetHeader*)calloc(n, sizeof *s->hs);
+    s->order = (size_t*)malloc(n * sizeof *s->order);
+    if (!s->paths || !s->hs || !s->order) { stream_close(s); return NULL; }
+    for (size_t i = 0; i < n; ++i) {
+        DatasetHeader *h = &s->hs[i];
+        FILE *f = paths[i] ? stream_file(paths[i], h) : NULL;
+        if (f) fclose(f);
+        /* every shard the same shape, all with labels or none */
+        if (!f || (i && (h->in_cols != s->h.in_cols || h->out_cols != s->h.out_cols || !h->classes != !s->h.classes)) ||
+            !(s->paths[i] = strdup(paths[i]))) { stream_close(s); return NULL; }
+        if (!i) s->h = *h;
+        else s->h.rows += h->rows;
+        if (h->classes > s->h.classes) s->h.classes = h->classes;
+    }
+    s->h.in_off = s->h.out_off = s->h.labels_off = 0;
+    const size_t ic = s->h.in_cols, oc = s->h.out_cols;
+    if (!window) window = 32 * batch;
+    s->window = (window + batch - 1) / batch * batch;
+    s->chunk = XNN_STREAM_CHUNK / (ic*sizeof(float));
+    if (!s->chunk) s->chunk = 1;
+    if (s->chunk > s->window) s->chunk = s->window;
+    s->stage = (float*)xnn_alloc(s->chunk*(ic + oc)*sizeof(float));
+    s->stage_l = (uint16_t*)malloc(s->chunk * sizeof(uint16_t));
+    s->perm = (size_t*)malloc(s->window * sizeof *s->perm);
+    int ok = s->stage && s->stage_l && s->perm;
+    for (int b = 0; b < 2 && ok; ++b) {
+        XnnWindow *w = &s->w[b];
+        w->in = (float*)xnn_alloc(s->window*ic*sizeof(float));
+        w->out = oc ? (float*)xnn_alloc(s->window*oc*sizeof(float)) : NULL;
+        w->labels = s->h.classes ? (uint16_t*)malloc(s->window * sizeof(uint16_t)) : NULL;
+        ok = w->in && (!oc || w->out) && (!s->h.classes || w->labels);
+    }
+    if (!ok || pthread_create(&s->th, NULL, stream_worker, s)) { stream_close(s); return NULL; }
+    s->started = 1;
+    return s;
+}
+
+int stream_next(DataStream *s, Data *batch)
+{
+    if (!s || !batch) return -1;
+    for (;;) {
+        XnnWindow *w = &s->w[s->cur];
+        if (!s->have) {
+            pthread_mutex_lock(&s->mu);
+            while (!w->full) pthread_cond_wait(&s->cv, &s->mu);
+            pthread_mutex_unlock(&s->mu);
+            s->have = 1; s->pos = 0;
+        }
+        if (w->err) return -1;
+        if (s->pos + s->batch <= w->rows) {
+            s->bin = (Matrix){ s->batch, s->h.in_cols, w->in + s->pos*s->h.in_cols };
+            s->bout = (Matrix){ s->batch, s->h.out_cols, w->out ? w->out + s->pos*s->h.out_cols : NULL };
+            batch->in = &s->bin;
+            batch->out = w->out ? &s->bout : NULL;
+            batch->labels = w->labels ? w->labels + s->pos : NULL;
+            s->pos += s->batch;
+            return 1;
+        }
+        int end = w->end;
+        pthread_mutex_lock(&s->mu);
+        w->full = 0;
+        pthread_cond_broadcast(&s->cv);
+        pthread_mutex_unlock(&s->mu);
+        s->have = 0; s->cur ^= 1;
+        if (end) return 0;
+    }
+}
+
+const DatasetHeader *stream_header(const DataStream *s) { return s ? &s->h : NULL; }
+
+void stream_close(DataStream *s)
+{
+    if (!s) return;
+    if (s->started) {
+        pthread_mutex_lock(&s->mu);
+        s->stop = 1;
+        pthread_cond_broadcast(&s->cv);
+        pthread_mutex_unlock(&s->mu);
+        pthread_join(s->th, NULL);
+    }
+    for (int b = 0; b < 2; ++b) { xnn_free(s->w[b].in); xnn_free(s->w[b].out); free(s->w[b].labels); }
+    for (size_t i = 0; s->paths && i < s->n; ++i) free(s->paths[i]);
+    free(s->paths); free(s->hs); free(s->order); free(s->perm);
+    xnn_free(s->stage); free(s->stage_l);
+    pthread_mutex_destroy(&s->mu);
+    pthread_cond_destroy(&s->cv);
+    free(s);
+}
+
+/* ---------- IDX files ----------
+ * MNIST's own format: 0, 0, type (0x08 = unsigned byte), ndim, then ndim
+ * big-endian uint32 sizes and the data. The bytes stay in the mapping;
+ * idx_tensor's u8 view scales them as batches are staged, so the resident
+ * set is a quarter of the float copy. */
+struct IdxFile {
+    char *map;
+    size_t size, items, item_size;
+    const uint8_t *data;
+};
+
+IdxFile *idx_open(const char *path)
+{
+    size_t size = 0;
+    char *map = path ? xnn_map_file(path, &size) : NULL;
+    const uint8_t *b = (const uint8_t*)map;
+    IdxFile *f = NULL;
+    if (map && size >= 4 && !b[0] && !b[1] && b[2] == 0x08 && b[3] >= 1 && size >= 4 + 4*(size_t)b[3]) {
+        size_t dims[256], n = 1, hdr = 4 + 4*(size_t)b[3];
+        for (int d = 0; d < b[3]; ++d) {
+            const uint8_t *p = b + 4 + 4*d;
+            dims[d] = (size_t)p[0] << 24 | (size_t)p[1] << 16 | (size_t)p[2] << 8 | p[3];
+            if (dims[d] && n > (size - hdr) / dims[d]) n = SIZE_MAX;
+            else n *= dims[d];
+        }
+        if (n != SIZE_MAX && n && hdr + n <= size && (f = (IdxFile*)calloc(1, sizeof *f))) {
+            f->map = map; f->size = size; f->data = b + hdr;
+            f->items = dims[0]; f->item_size = n / dims[0];
+            return f;
+        }
+    }
+    xnn_unmap_file(map, size);
+    return NULL;
+}
+Tensor idx_tensor(const IdxFile *f, float scale)
+{ return f ? tensor_u8(f->data, f->items, f->item_size, scale) : tensor_bad(); }
+uint16_t *idx_labels(const IdxFile *f)
+{
+    uint16_t *l = f ? (uint16_t*)malloc(f->items * f->item_size * sizeof *l) : NULL;
+    for (size_t i = 0; l && i < f->items * f->item_size; ++i) l[i] = f->data[i];
+    return l;
+}
+void idx_close(IdxFile *f)
+{
+    if (!f) return;
+    xnn_unmap_file(f->map, f->size);
+    free(f);
+}
+
+#define XNN_MSE_CHUNK 256   /* rows per forward pass in the loss functions */
+/* Mean per-row loss of kind loss (LOSS_*) against out's rows or class ids
+ * (indexed as in backprop_labels). CE reads the output probabilities, so a
+ * zero one is clamped to FLT_MIN (a row costs at most ~87). */
+static float eval_loss(const Network *net, const Tensor *in, const Tensor *out, const uint16_t *labels, int loss_type)
+{
+    Tensor x, t = tensor_bad();
+    if (!net || tensor_flat2(in, net->a[0]->rows, &x)) return 0.0f;
+    if (!labels && (tensor_flat2(out, net->a[net->layers-1]->rows, &t) || t.u8)) return 0.0f;
+    size_t batch = x.shape[0], out_sz = net->a[net->layers-1]->rows;
+    if (!batch || (!labels && batch != t.shape[0])) return 0.0f;
+
+    /* the calling thread's session: no allocations once it has grown */
+    double loss = 0.0;
+    for (size_t r = 0; r < batch; r += XNN_MSE_CHUNK) {
+        size_t n = batch - r < XNN_MSE_CHUNK ? batch - r : XNN_MSE_CHUNK;
+        Tensor xc = tensor_slice(x, 0, r, r + n);
+        const Matrix *y = session_run(xnn_tls(), net, &xc);
+        if (!y) return 0.0f;
+        for (size_t i = 0; i < n; ++i) {
+            const float *ti = labels ? NULL : tensor_row(&t, r + i), *yi = y->data + i*out_sz;
+            size_t lab = labels ? labels[x.index ? x.index[r + i] : r + i] : out_sz;
+            for (size_t j = 0; j < out_sz; ++j) {
+                float tj = ti ? ti[(ptrdiff_t)j*t.stride[1]] : j == lab ? 1.0f : 0.0f;
+                if (loss_type == LOSS_MSE) loss += (yi[j] - tj) * (yi[j] - tj);
+                else if (tj != 0.0f) loss -= tj * logf(yi[j] > FLT_MIN ? yi[j] : FLT_MIN);
+            }
+        }
+    }
+    return (float)(loss / batch);
+}
+float network_mse_view(const Network *net, const Tensor *in, const Tensor *out)
+{ return eval_loss(net, in, out, NULL, LOSS_MSE); }
+/* Data with labels scores against the one-hot rows they stand for */
+float network_mse(const Network *net, const Data *data)
+{
+    if (!data || !data->in || (!data->out && !data->labels)) return 0.0f;
+    Tensor in = matrix_view(data->in), out = data->out ? matrix_view(data->out) : tensor_bad();
+    return eval_loss(net, &in, &out, data->labels, LOSS_MSE);
+}
+float network_loss_view(const Network *net, const Tensor *in, const Tensor *out)
+{ return net ? eval_loss(net, in, out, NULL, net->loss) : 0.0f; }
+float network_loss_labels(const Network *net, const Tensor *in, const uint16_t *labels)
+{ return net && labels ? eval_loss(net, in, NULL, labels, net->loss) : 0.0f; }
+float network_loss(const Network *net, const Data *data)
+{
+    if (!net || !data || !data->in || (!data->out && !data->labels)) return 0.0f;
+    Tensor in = matrix_view(data->in), out = data->out ? matrix_view(data->out) : tensor_bad();
+    return eval_loss(net, &in, &out, data->labels, net->loss);
+}
+
+void network_predict(const Network *net, const float *input, float *output)
+{
+    if (!net || !input || !output) return;
+    Matrix m = { 1, net->a[0]->rows, (float*)input };
+    Tensor x = matrix_view(&m);
+    const Matrix *y = session_run(xnn_tls(), net, &x);
+    if (y) memcpy(output, y->data, y->cols * sizeof(float));
+}
+
+/* Chunks of rows go through the GEMMs on the pool, each on its thread's
+ * session, so a warm call allocates nothing. */
+#define XNN_PREDICT_CHUNK 128
+typedef struct { const Network *net; const float *in; float *out; size_t n; int err; } XnnPredict;
+static void predict_range(void *ctx, size_t b, size_t e)
+{
+    XnnPredict *p = (XnnPredict*)ctx;
+    size_t in_sz = p->net->a[0]->rows, out_sz = p->net->a[p->net->layers-1]->rows;
+    for (size_t c = b; c < e; ++c) {
+        size_t r0 = c*XNN_PREDICT_CHUNK, rows = p->n - r0 < XNN_PREDICT_CHUNK ? p->n - r0 : XNN_PREDICT_CHUNK;
+        Matrix m = { rows, in_sz, (float*)p->in + r0*in_sz };
+        Tensor x = matrix_view(&m);
+        const Matrix *y = session_run(xnn_tls(), p->net, &x);
+        if (y) memcpy(p->out + r0*out_sz, y->data, rows*out_sz*sizeof(float));
+        else __atomic_store_n(&p->err, 1, __ATOMIC_RELAXED);   /* session out of memory */
+    }
+}
+int network_predict_batch(const Network *net, const float *input, size_t n, float *output)
+{
+    if (!net || !input || !output || !n) return -1;
+    XnnPredict p = { net, input, output, n, 0 };
+    xnn_parallel_for(0, (n + XNN_PREDICT_CHUNK-1)/XNN_PREDICT_CHUNK, 1, predict_range, &p);
+    return p.err ? -1 : 0;
+}
+
+/* Same chunks on the pool; a one-output net predicts class 1 above 0.5.
+ * labels are indexed as in backprop_labels. */
+typedef struct { const Network *net; Tensor x; const uint16_t *labels; size_t correct; } XnnAccuracy;
+static void accuracy_range(void *ctx, size_t b, size_t e)
+{
+    XnnAccuracy *a = (XnnAccuracy*)ctx;
+    size_t n = a->x.shape[0], out_sz = a->net->a[a->net->layers-1]->rows, correct = 0;
+    for (size_t c = b; c < e; ++c) {
+        size_t r0 = c*XNN_PREDICT_CHUNK, rows = n - r0 < XNN_PREDICT_CHUNK ? n - r0 : XNN_PREDICT_CHUNK;
+        Tensor xc = tensor_slice(a->x, 0, r0, r0 + rows);
+        const Matrix *y = session_run(xnn_tls(), a->net, &xc);
+        if (!y) return;
+        for (size_t i = 0; i < rows; ++i) {
+            const float *yi = y->data + i*out_sz;
+            size_t pred = out_sz == 1 ? yi[0] > 0.5f : 0;
+            for (size_t j = 1; j < out_sz; ++j) if (yi[j] > yi[pred]) pred = j;
+            correct += pred == a->labels[a->x.index ? a->x.index[r0 + i] : r0 + i];
+        }
+    }
+    __atomic_fetch_add(&a->correct, correct, __ATOMIC_RELAXED);
+}
+float network_accuracy(const Network *net, const Tensor *in, const uint16_t *labels)
+{
+    XnnAccuracy a = { net, tensor_bad(), labels, 0 };
+    if (!net || !labels || tensor_flat2(in, net->a[0]->rows, &a.x) || !a.x.shape[0]) return 0.0f;
+    xnn_parallel_for(0, (a.x.shape[0] + XNN_PREDICT_CHUNK-1)/XNN_PREDICT_CHUNK, 1, accuracy_range, &a);
+    return (float)a.correct / a.x.shape[0];
+}
+
+/* ---------- Quantized inference ----------
+ * Weights are int8, symmetric per output channel; each layer's input is
+ * u8 with one scale/zero-point from the calibration ranges (zero-point 0
+ * after ReLU, 128 when the range has both signs). With a = sa*(qa - za),
+ * w = sw*qw:  z_j = sa*sw_j*(sum qa*qw_j - za*sum qw_j) + b_j, the sum an
+ * exact int32 dot product; activations are applied in fp32 and the result
+ * re-quantized for the next layer. Rows are zero-padded to 64 bytes. */
+struct QNetwork {
+    size_t layers;
+    size_t *n, *kp;      // arch, and padded input width per layer
+    int *activations;
+    int fast;
+    int8_t **w;          // kp[l] x n[l+1], row j = output channel j
+    float **scale;       // sa*sw_j per channel
+    int32_t **corr;      // za*sum(qw_j)
+    float **b;
+    float *sa;           // input scale per layer
+    int *za;             // input zero-point per layer
+    size_t wmax;         // widest kp: per-call scratch size
+};
+
+void qnetwork_free(QNetwork *q)
+{
+    if (!q) return;
+    for (size_t l = 0; l + 1 < q->layers; ++l) {
+        if (q->w) xnn_free(q->w[l]);
+        if (q->scale) free(q->scale[l]);
+        if (q->corr) free(q->corr[l]);
+        if (q->b) free(q->b[l]);
+    }
+    free(q->w); free(q->scale); free(q->corr); free(q->b);
+    free(q->n); free(q->kp); free(q->activations);
+    free(q->sa); free(q->za);
+    free(q);
+}
+
+static void xnn_range(const float *x, size_t n, float *lo, float *hi)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (x[i] < *lo) *lo = x[i];
+        if (x[i] > *hi) *hi = x[i];
+    }
+}
+
+QNetwork *network_quantize(const Network *net, const Data *calib)
+{
+    if (!net || !calib || !calib->in || calib->in->cols != net->a[0]->rows || !calib->in->rows) return NULL;
+    size_t L = net->layers, wmax = 0;
+    const Matrix *in = calib->in;
+    QNetwork *q = calloc(1, sizeof *q);
+    if (!q) return NULL;
+    q->layers = L;
+    q->fast = net->fast;
+    q->n = malloc(L*sizeof(size_t));
+    q->kp = malloc(L*sizeof(size_t));
+    q->activations = malloc(L*sizeof(int));
+    q->w = calloc(L-1, sizeof(int8_t*));
+    q->scale = calloc(L-1, sizeof(float*));
+    q->corr = calloc(L-1, sizeof(int32_t*));
+    q->b = calloc(L-1, sizeof(float*));
+    q->sa = malloc(L*sizeof(float));
+    q->za = malloc(L*sizeof(int));
+    float *lo = calloc(L, sizeof(float)), *hi = calloc(L, sizeof(float));
+    Network *tmp = network_clone(net);   // forward_batch keeps every layer's rows in tmp->ab
+    if (!q->n || !q->kp || !q->activations || !q->w || !q->scale || !q->corr || !q->b ||
+        !q->sa || !q->za || !lo || !hi || !tmp) goto fail;
+
+    /* calibration: activation ranges over the whole set, in forward_batch chunks */
+    for (size_t l = 0; l < L; ++l) {
+        q->n[l] = net->a[l]->rows;
+        q->kp[l] = (q->n[l] + 63) & ~(size_t)63;
+        q->activations[l] = net->activations[l];
+        if (q->kp[l] > wmax) wmax = q->kp[l];
+    }
+    xnn_range(in->data, in->rows*in->cols, &lo[0], &hi[0]);
+    for (size_t r = 0; r < in->rows; r += XNN_MSE_CHUNK) {
+        Matrix x = { in->rows - r < XNN_MSE_CHUNK ? in->rows - r : XNN_MSE_CHUNK, in->cols, in->data + r*in->cols };
+        if (!forward_batch(tmp, &x)) goto fail;
+        for (size_t l = 1; l + 1 < L; ++l) xnn_range(tmp->ab[l], x.rows*q->n[l], &lo[l], &hi[l]);
+    }
+    for (size_t l = 0; l + 1 < L; ++l) {
+        float m = fmaxf(-lo[l], hi[l]);
+        if (m <= 0) m = 1.0f;
+        q->za[l] = lo[l] < 0 ? 128 : 0;
+        q->sa[l] = lo[l] < 0 ? m/127 : m/255;
+    }
+
+    for (size_t l = 0; l + 1 < L; ++l) {
+        size_t n = q->n[l+1], k = q->n[l], kp = q->kp[l];
+        const float *W = net->w[l]->data;
+        if ((q->w[l] = xnn_alloc(n*kp))) memset(q->w[l], 0, n*kp);
+        q->scale[l] = malloc(n*sizeof(float));
+        q->corr[l] = malloc(n*sizeof(int32_t));
+        q->b[l] = malloc(n*sizeof(float));
+        if (!q->w[l] || !q->scale[l] || !q->corr[l] || !q->b[l]) goto fail;
+        memcpy(q->b[l], net->b[l]->data, n*sizeof(float));
+        for (size_t j = 0; j < n; ++j) {
+            float m = 0.0f;
+            for (size_t i = 0; i < k; ++i) m = fmaxf(m, fabsf(W[j*k+i]));
+            float sw = m > 0 ? m/127 : 1.0f;
+            int32_t sum = 0;
+            for (size_t i = 0; i < k; ++i) {
+                long v = lrintf(W[j*k+i] / sw);
+                q->w[l][j*kp+i] = (int8_t)(v > 127 ? 127 : v < -127 ? -127 : v);
+                sum += q->w[l][j*kp+i];
+            }
+            q->scale[l][j] = q->sa[l] * sw;
+            q->corr[l][j] = q->za[l] * sum;
+        }
+    }
+    q->wmax = wmax;
+    free(lo); free(hi); network_free(tmp);
+    return q;
+fail:
+    free(lo); free(hi); network_free(tmp);
+    qnetwork_free(q);
+    return NULL;
+}
+
+/* Scratch is per call (on the stack up to XNN_Q8_STACK wide), so threads
+ * can share one QNetwork. */
+#define XNN_Q8_STACK 4096
+int network_predict_q8(const QNetwork *q, const float *input, float *output)
+{
+    if (!q || !input || !output) return -1;
+    uint8_t xs[XNN_Q8_STACK];
+    float hs[XNN_Q8_STACK];
+    int heap = q->wmax > XNN_Q8_STACK;
+    uint8_t *xq = heap ? (uint8_t*)malloc(q->wmax) : xs;
+    float *h = heap ? (float*)malloc(q->wmax*sizeof(float)) : hs;
+    if (xq && h) {
+        const XnnKernels *k = xk();
+        const float *x = input;
+        for (size_t l = 0; l + 1 < q->layers; ++l) {
+            float inv = 1.0f / q->sa[l];
+            int za = q->za[l];
+            size_t n = q->n[l+1], kp = q->kp[l];
+            for (size_t i = 0; i < q->n[l]; ++i) {
+                long v = lrintf(x[i]*inv) + za;
+                xq[i] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+            }
+            memset(xq + q->n[l], 0, kp - q->n[l]);   /* padding meets zero weights */
+            for (size_t j = 0; j < n; ++j)
+                h[j] = (float)(k->dot_q8(xq, q->w[l] + j*kp, kp) - q->corr[l][j]) * q->scale[l][j] + q->b[l][j];
+            if (q->activations[l+1] == ACT_SOFTMAX) softmax(h, n, q->fast);
+            else { Matrix m = { n, 1, h }; activate(&m, q->activations[l+1], q->fast); }
+            x = h;
+        }
+        memcpy(output, h, q->n[q->layers-1]*sizeof(float));
+    }
+    int rc = xq && h ? 0 : -1;
+    if (heap) { free(xq); free(h); }
+    return rc;
 }
 
 /* Seed RNG once */
@@ -456,6 +3760,7 @@ static void init_xnn(void)
     static int done = 0;
     if (!done) {
         srand((unsigned)time(NULL));
+        xnn_set_isa(-1);
         done = 1;
     }
 }